@@ -15,6 +15,9 @@
 #define IDS_STRING111                   111
 #define IDS_STRING112                   112
 #define IDS_STRING113                   113
+#define IDS_STRING114                   114
+#define IDS_STRING115                   115
+#define IDS_STRING116                   116
 
 // Next default values for new objects
 //
@@ -2,12 +2,24 @@
 // Built using Triglav Plugin SDK
 // Ports the pixel sorting algorithm from the Python PixelSorting project.
 
+#include "PlugInCommon/Win/PISystemWin.h"
 #include "TriglavPlugInSDK/TriglavPlugInSDK.h"
+#include "PixelSortCore/PIRenderCache.h"
+#include "PixelSortCore/PIRenderPipeline.h"
+#include "PixelSortCore/PIRenderTuning.h"
 #include "PlugInCommon/PIPixelSort.h"
+#include "PlugInCommon/PIKeySIMD.h"
+#include "PlugInCommon/PILineTrace.h"
+#include "PlugInCommon/PIPixelCopy.h"
+#include "PlugInCommon/PIProxy.h"
+#include "PlugInCommon/PISelectCoverage.h"
+#include "PlugInCommon/PISortLine.h"
 #include "PlugInCommon/PISpanDetector.h"
+#include "PlugInCommon/PISortEngine.h"
+#include "PlugInCommon/PIThreadPool.h"
 #include <vector>
 #include <algorithm>
-#include <random>
+#include <fstream>
 #include <cmath>
 
 // ---------------------------------------------------------------------------
@@ -25,6 +37,9 @@ static const int kItemKeySpanMin        = 8;
 static const int kItemKeySpanMax        = 9;
 static const int kItemKeyAngle         = 10;
 static const int kItemKeyFalloff       = 11;
+static const int kItemKeyEdgeScope     = 12;
+static const int kItemKeySkipTransparent = 13;
+static const int kItemKeySeed          = 14;
 
 // ---------------------------------------------------------------------------
 // String resource IDs
@@ -43,16 +58,197 @@ static const int kStringIDItemCaptionSpanMin         = 110;
 static const int kStringIDItemCaptionSpanMax         = 111;
 static const int kStringIDItemCaptionAngle           = 112;
 static const int kStringIDItemCaptionFalloff         = 113;
+static const int kStringIDItemCaptionEdgeScope       = 114;
+static const int kStringIDItemCaptionSkipTransparent = 115;
+static const int kStringIDItemCaptionSeed            = 116;
+
+// ---------------------------------------------------------------------------
+// Source cache (gathered once per FilterRun, reused by every preview restart)
+// ---------------------------------------------------------------------------
+
+// The select area rect as a SourceImage, plus what the destination needs
+struct SourceCache : SourceImage
+{
+	std::vector<BYTE> blockCoverage; // SelectCoverage per block rect, empty if there is no selection
+	bool              skipTransparent; // `select` has transparent pixels cleared
+	bool              valid;
+
+	void Release()
+	{
+		std::vector<BYTE>().swap(image);
+		std::vector<BYTE>().swap(select);
+		std::vector<BYTE>().swap(blockCoverage);
+		width = height = 0;
+		skipTransparent = false;
+		valid = false;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Pixel I/O backends (block copy or bulk bitmap transfer)
+// ---------------------------------------------------------------------------
+
+enum PixelIOBackend
+{
+	kPixelIOBlock        = 0, // getBlockImageProc + row copy kernels
+	kPixelIOBitmap       = 1, // OffscreenGetBitmap / SetBitmap through a host bitmap
+	kPixelIOBackendCount = 2
+};
+
+static const char* PixelIOBackendName(PixelIOBackend backend)
+{
+	return backend == kPixelIOBitmap ? "bitmap" : "block";
+}
+
+// Transfers each backend is timed on before the faster one is kept
+static const int kPixelIOSamples = 3;
+
+// Transfer times per backend for one direction (gather or scatter), kept
+// while the module is loaded. The backends take turns until each has
+// kPixelIOSamples transfers; after that the one with the lower best time
+// per pixel is used (the best, so a cold first transfer does not decide).
+struct PixelIOTiming
+{
+	double bestSecondsPerPixel[kPixelIOBackendCount];
+	int    samples[kPixelIOBackendCount];
+
+	PixelIOTiming()
+	{
+		for (int b = 0; b < kPixelIOBackendCount; ++b)
+		{
+			bestSecondsPerPixel[b] = 0.0;
+			samples[b] = 0;
+		}
+	}
+
+	PixelIOBackend Choose(bool bitmapAvailable) const
+	{
+		if (!bitmapAvailable) return kPixelIOBlock;
+		if (samples[kPixelIOBlock] < kPixelIOSamples || samples[kPixelIOBitmap] < kPixelIOSamples)
+			return samples[kPixelIOBitmap] < samples[kPixelIOBlock] ? kPixelIOBitmap : kPixelIOBlock;
+		return bestSecondsPerPixel[kPixelIOBitmap] < bestSecondsPerPixel[kPixelIOBlock] ? kPixelIOBitmap : kPixelIOBlock;
+	}
+
+	void Add(PixelIOBackend backend, double seconds, double pixels)
+	{
+		if (pixels <= 0.0) return;
+		double perPixel = seconds / pixels;
+		if (samples[backend] == 0 || perPixel < bestSecondsPerPixel[backend])
+			bestSecondsPerPixel[backend] = perPixel;
+		++samples[backend];
+	}
+
+	// One line per direction: best ms per megapixel and transfer count for
+	// each backend, and the backend the next transfer will use
+	void Log(const char* direction, bool bitmapAvailable) const
+	{
+		PixelSortLog("[PixelSort] I/O %s: block %.2f ms/MP (%d), bitmap %.2f ms/MP (%d), next %s\n", direction,
+			bestSecondsPerPixel[kPixelIOBlock] * 1e9, samples[kPixelIOBlock],
+			bestSecondsPerPixel[kPixelIOBitmap] * 1e9, samples[kPixelIOBitmap],
+			PixelIOBackendName(Choose(bitmapAvailable)));
+	}
+};
+
+struct PixelIOState
+{
+	PixelIOTiming gather;
+	PixelIOTiming scatter;
+	bool          bitmapRejected;       // a bitmap transfer did not match the block data
+	bool          gatherBitmapVerified; // channel order confirmed for OffscreenGetBitmap
+	bool          scatterBitmapVerified; // ... and for OffscreenSetBitmap
+};
+
+// Host bitmap covering the select area rect (depth 3, top-left scanline).
+// Its channel order is assumed to be R, G, B. Bitmap transfers are checked
+// against the block data until a check has seen a pixel whose channels all
+// differ, which pins the order down.
+struct HostBitmap
+{
+	TriglavPlugInBitmapService* pBitmapService;
+	TriglavPlugInBitmapObject   object;
+	BYTE*                       base;
+	int                         width, height;
+	int                         rowBytes;
+	PixelLayout                 layout;
+
+	HostBitmap() : pBitmapService(NULL), object(NULL), base(NULL), width(0), height(0), rowBytes(0)
+	{
+		layout = MakePixelLayout(3, 0, 1, 2);
+	}
+
+	~HostBitmap()
+	{
+		Release();
+	}
+
+	bool Create(TriglavPlugInBitmapService* svc, int w, int h)
+	{
+		Release();
+		if (svc == NULL || svc->createProc == NULL) return false;
+		if (svc->createProc(&object, w, h, 3, kTriglavPlugInBitmapScanlineHorizontalLeftTop) != kTriglavPlugInAPIResultSuccess)
+		{
+			object = NULL;
+			return false;
+		}
+		pBitmapService = svc;
+		width = w;
+		height = h;
+
+		TriglavPlugInPtr addr = NULL;
+		TriglavPlugInPoint origin; origin.x = 0; origin.y = 0;
+		TriglavPlugInInt rb = 0, pb = 0;
+		svc->getAddressProc(&addr, object, &origin);
+		svc->getRowBytesProc(&rb, object);
+		svc->getPixelBytesProc(&pb, object);
+		if (addr == NULL || pb < 3)
+		{
+			Release();
+			return false;
+		}
+		base = static_cast<BYTE*>(addr);
+		rowBytes = rb;
+		layout = MakePixelLayout(pb, 0, 1, 2);
+		return true;
+	}
+
+	void Release()
+	{
+		if (object != NULL && pBitmapService != NULL)
+			pBitmapService->releaseProc(object);
+		object = NULL;
+		base = NULL;
+		width = height = 0;
+	}
+
+	bool Valid() const
+	{
+		return object != NULL;
+	}
+
+	BYTE* Pixel(int x, int y) const
+	{
+		return base + static_cast<size_t>(y) * rowBytes + static_cast<size_t>(x) * layout.pixelBytes;
+	}
+};
 
 // ---------------------------------------------------------------------------
 // Filter info struct (persistent across calls)
 // ---------------------------------------------------------------------------
 
+struct PixelSortWorkspace;
+
 struct PixelSortFilterInfo
 {
 	PixelSortParams params;
 	TriglavPlugInPropertyService* pPropertyService;
 	TriglavPlugInPropertyService2* pPropertyService2;
+	PixelSortThreadPool* pThreadPool; // created on first FilterRun
+	PixelSortDevice* pSortDevice;     // GPU sort backend, looked for on first FilterRun; NULL if none
+	bool sortDeviceTried;
+	RenderTuning tuning;              // engine choices, read or calibrated with the pool
+	PixelSortWorkspace* pWorkspace;   // created on first FilterRun, freed at FilterTerminate
+	SourceCache source;               // valid for the current FilterRun only
+	PixelIOState io;                  // backend timings, kept while the module is loaded
 };
 
 // ---------------------------------------------------------------------------
@@ -80,6 +276,9 @@ static void ReadAllProperties(
 
 		ps2->getEnumerationValueProc(&val, propertyObject, kItemKeyIntervalMode);
 		pInfo->params.intervalMode = static_cast<IntervalMode>(val);
+
+		ps2->getEnumerationValueProc(&val, propertyObject, kItemKeyEdgeScope);
+		pInfo->params.edgeScope = static_cast<EdgeScope>(val);
 	}
 
 	// Integer properties (via propertyService)
@@ -108,6 +307,12 @@ static void ReadAllProperties(
 	ps->getIntegerValueProc(&val, propertyObject, kItemKeyFalloff);
 	pInfo->params.falloff = val;
 
+	ps->getBooleanValueProc(&boolVal, propertyObject, kItemKeySkipTransparent);
+	pInfo->params.skipTransparent = (boolVal != 0);
+
+	ps->getIntegerValueProc(&val, propertyObject, kItemKeySeed);
+	pInfo->params.seed = val;
+
 	ClampParams(pInfo->params);
 }
 
@@ -142,131 +347,1149 @@ static void TRIGLAV_PLUGIN_CALLBACK TriglavPlugInFilterPropertyCallBack(
 }
 
 // ---------------------------------------------------------------------------
-// Sort a single line (row or column) of pixels
+// Destination block memory, for sorting lines in place
 // ---------------------------------------------------------------------------
 
-static void SortLine(
-	const RowAccessor& row,
-	const PixelSortParams& params,
-	const BYTE* selectArea,       // NULL if no selection, otherwise 0-255 per pixel
-	int selectPixelStride,        // stride between selection pixels
-	int rowIndex,
-	std::mt19937& rng,
-	std::vector<Span>& spansWork,
-	std::vector<float>& brightnessWork,
-	std::vector<PixelData>& pixelsWork,
-	std::vector<int>& includedIndices)
-{
-	int n = row.length;
-	if (n <= 0) return;
-
-	// Detect spans
-	DetectSpans(row, params, rowIndex, rng, spansWork, brightnessWork);
-
-	for (int si = 0; si < static_cast<int>(spansWork.size()); ++si)
-	{
-		int spanStart = spansWork[si].start;
-		int spanEnd   = spansWork[si].end;
-		int spanLen   = spanEnd - spanStart;
-		if (spanLen < 2) continue;
-
-		// Falloff: randomly skip this span
-		if (params.falloff > 0)
+struct DestinationBlock
+{
+	TriglavPlugInRect rect; // relative to the select area rect
+	BYTE*             addr; // pixel at (rect.left, rect.top)
+	int               rowBytes;
+	int               pixelBytes;
+};
+
+// ---------------------------------------------------------------------------
+// Streaming band (unrotated horizontal passes over huge images)
+// ---------------------------------------------------------------------------
+
+// One band of tile rows. A streaming pass holds two: one is read from the
+// host while the other sorts.
+struct StreamBand
+{
+	std::vector<BYTE>             image;      // packed RGB source rows
+	std::vector<BYTE>             select;     // 0-255 per pixel, if anything is masked
+	KeyPlane                      keyPlane;
+	int                           y0, y1;     // select-area rows held
+	bool                          hasSelection; // `select` is filled
+};
+
+// ---------------------------------------------------------------------------
+// Working memory kept across restarts and FilterRuns
+// ---------------------------------------------------------------------------
+
+// Every buffer a FilterRun sorts in. It is owned by PixelSortFilterInfo, so
+// preview restarts and later runs refill buffers that already have their
+// capacity instead of allocating. Freed at FilterTerminate.
+struct PixelSortWorkspace
+{
+	std::vector<LineScratch> scratches; // one per worker
+	StageCache               stages;
+
+	// Previews of large images are first rendered on a downsampled proxy
+	SourceCache              proxySource;
+	StageCache               proxyStages;
+	std::vector<BYTE>        proxyUpsampled;
+
+	// Streaming passes hold only these bands
+	StreamBand               stream[2];
+
+	// Finished full-resolution results of this dialog session
+	RenderCache              renders;
+
+	// In-place rows: destination block addresses, refilled every pass, and
+	// the blocks each worker's current row crosses
+	std::vector<DestinationBlock>                      destBlocks;
+	std::vector<std::vector<const DestinationBlock*> > rowBlocks; // one per worker
+
+	PixelSortWorkspace()
+	{
+		proxySource.valid = false;
+	}
+
+	// Start of a FilterRun: the source pixels are new
+	void Reset(int threadCount)
+	{
+		scratches.resize(threadCount);
+		rowBlocks.resize(threadCount);
+		stages.Invalidate();
+		proxyStages.Invalidate();
+		proxySource.valid = false;
+		renders.Clear();
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Gather the select area rect from the offscreen blocks into the source cache
+// ---------------------------------------------------------------------------
+
+// Result of comparing the offscreen blocks with the packed RGB full image
+enum BlockMatch
+{
+	kBlockMatchDiffers    = 0,
+	kBlockMatchSame       = 1, // equal, but every pixel had two equal channels
+	kBlockMatchConclusive = 2  // equal, including a pixel with three distinct channels
+};
+
+// Compares [x0, x1) x [y0, y1) (select-area coordinates) of the offscreen
+// blocks with the full image. Used to check bitmap transfers, whose channel
+// order the SDK does not spell out.
+static BlockMatch CompareBlocksRect(
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject offscreen,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	int rIdx, int gIdx, int bIdx,
+	const BYTE* fullImage, int fullW,
+	int x0, int y0, int x1, int y1)
+{
+	const TriglavPlugInRect& sar = selectAreaRect;
+	ReadPixelsRGBFunc read = GetPixelCopyKernel().read;
+	BlockMatch match = kBlockMatchSame;
+	std::vector<BYTE> row;
+	for (size_t bi = 0; bi < blockRects.size(); ++bi)
+	{
+		const TriglavPlugInRect& br = blockRects[bi];
+		TriglavPlugInRect r;
+		r.left   = (std::max)(br.left,   sar.left + x0);
+		r.top    = (std::max)(br.top,    sar.top + y0);
+		r.right  = (std::min)(br.right,  sar.left + x1);
+		r.bottom = (std::min)(br.bottom, sar.top + y1);
+		if (r.left >= r.right || r.top >= r.bottom) continue;
+
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
+		(*pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, offscreen, &bpos);
+		if (imgAddr == NULL) continue;
+
+		PixelLayout layout = MakePixelLayout(imgPB, rIdx, gIdx, bIdx);
+		int n = r.right - r.left;
+		row.resize(n * 3);
+		for (int y = r.top; y < r.bottom; ++y)
 		{
-			std::uniform_int_distribution<int> falloffDist(0, 99);
-			if (falloffDist(rng) < params.falloff) continue;
+			const BYTE* sr = static_cast<BYTE*>(imgAddr) + (y - br.top) * imgRB + (r.left - br.left) * imgPB;
+			read(sr, layout, row.data(), n);
+			const BYTE* expected = fullImage + (static_cast<size_t>(y - sar.top) * fullW + (r.left - sar.left)) * 3;
+			if (memcmp(row.data(), expected, row.size()) != 0) return kBlockMatchDiffers;
+			for (int i = 0; match != kBlockMatchConclusive && i < n; ++i, expected += 3)
+			{
+				if (expected[0] != expected[1] && expected[1] != expected[2] && expected[0] != expected[2])
+					match = kBlockMatchConclusive;
+			}
 		}
+	}
+	return match;
+}
 
-		// Collect pixels in span, respecting selection mask
-		pixelsWork.clear();
-		includedIndices.clear();
+// Block backend: rows [y0, y1) of the select area (all of it for the source
+// cache, one band for streaming passes) go through the row copy kernel into
+// `image`, whose first row is y0
+static void GatherImageBlocks(
+	BYTE* image, int fullW, int y0, int y1,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	int rIdx, int gIdx, int bIdx)
+{
+	ReadPixelsRGBFunc read = GetPixelCopyKernel().read;
+	for (size_t bi = 0; bi < blockRects.size(); ++bi)
+	{
+		TriglavPlugInRect br = blockRects[bi];
+		int top = (std::max)(static_cast<int>(br.top), static_cast<int>(selectAreaRect.top) + y0);
+		int bottom = (std::min)(static_cast<int>(br.bottom), static_cast<int>(selectAreaRect.top) + y1);
+		if (top >= bottom) continue;
+
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
+		(*pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, imageOffscreenObject, &bpos);
+		if (imgAddr == NULL) continue;
+
+		PixelLayout layout = MakePixelLayout(imgPB, rIdx, gIdx, bIdx);
+		int bw = br.right - br.left;
+		int fx = br.left - selectAreaRect.left;
+		for (int y = top; y < bottom; ++y)
+		{
+			int fy = y - selectAreaRect.top - y0;
+			read(static_cast<BYTE*>(imgAddr) + (y - br.top) * imgRB, layout,
+				image + (static_cast<size_t>(fy) * fullW + fx) * 3, bw);
+		}
+	}
+}
 
-		for (int i = 0; i < spanLen; ++i)
+// Selection rows [y0, y1) into `select` (first row y0). Returns false if no
+// block has selection memory, i.e. there is nothing to mask. Rows of blocks
+// without selection memory are left as they are (unselected, if zeroed).
+static bool GatherSelectBlocks(
+	BYTE* select, int fullW, int y0, int y1,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject selectAreaOffscreenObject,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects)
+{
+	bool any = false;
+	for (size_t bi = 0; bi < blockRects.size(); ++bi)
+	{
+		TriglavPlugInRect br = blockRects[bi];
+		int top = (std::max)(static_cast<int>(br.top), static_cast<int>(selectAreaRect.top) + y0);
+		int bottom = (std::min)(static_cast<int>(br.bottom), static_cast<int>(selectAreaRect.top) + y1);
+		if (top >= bottom) continue;
+
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr selAddr; TriglavPlugInInt selRB, selPB;
+		(*pOffscreenService).getBlockSelectAreaProc(&selAddr, &selRB, &selPB, &tmpR, selectAreaOffscreenObject, &bpos);
+		if (selAddr == NULL) continue;
+
+		any = true;
+		int bw = br.right - br.left;
+		int fx = br.left - selectAreaRect.left;
+		for (int y = top; y < bottom; ++y)
 		{
-			int pixelIdx = spanStart + i;
-			if (pixelIdx >= n) break;
+			int fy = y - selectAreaRect.top - y0;
+			ReadPlane(static_cast<BYTE*>(selAddr) + (y - br.top) * selRB, selPB,
+				select + static_cast<size_t>(fy) * fullW + fx, bw);
+		}
+	}
+	return any;
+}
 
-			// Check selection mask
-			if (selectArea != NULL)
-			{
-				BYTE sel = selectArea[pixelIdx * selectPixelStride];
-				if (sel == 0) continue; // not selected, skip
-			}
+// Clears the `select` bytes (first row y0) of every zero-alpha pixel in rows
+// [y0, y1). Blocks without alpha memory are opaque. Returns true if any
+// pixel was transparent.
+static bool ClearTransparentBlocks(
+	BYTE* select, int fullW, int y0, int y1,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects)
+{
+	bool any = false;
+	for (size_t bi = 0; bi < blockRects.size(); ++bi)
+	{
+		TriglavPlugInRect br = blockRects[bi];
+		int top = (std::max)(static_cast<int>(br.top), static_cast<int>(selectAreaRect.top) + y0);
+		int bottom = (std::min)(static_cast<int>(br.bottom), static_cast<int>(selectAreaRect.top) + y1);
+		if (top >= bottom) continue;
+
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr alphaAddr; TriglavPlugInInt alphaRB, alphaPB;
+		(*pOffscreenService).getBlockAlphaProc(&alphaAddr, &alphaRB, &alphaPB, &tmpR, imageOffscreenObject, &bpos);
+		if (alphaAddr == NULL) continue;
+
+		int bw = br.right - br.left;
+		int fx = br.left - selectAreaRect.left;
+		for (int y = top; y < bottom; ++y)
+		{
+			int fy = y - selectAreaRect.top - y0;
+			if (ClearTransparentPixels(static_cast<BYTE*>(alphaAddr) + (y - br.top) * alphaRB, alphaPB,
+				select + static_cast<size_t>(fy) * fullW + fx, bw))
+				any = true;
+		}
+	}
+	return any;
+}
+
+// The mask a pass sorts through, rows [y0, y1) into `select` (first row y0,
+// zeroed by the caller): the host selection (every pixel if there is none),
+// with zero-alpha pixels cleared when `skipTransparent`. Returns false if
+// there is nothing to mask, i.e. every pixel is selected.
+static bool GatherMaskBlocks(
+	BYTE* select, int fullW, int y0, int y1,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	TriglavPlugInOffscreenObject selectAreaOffscreenObject, // NULL if no selection
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	bool skipTransparent)
+{
+	bool masked = selectAreaOffscreenObject != NULL &&
+		GatherSelectBlocks(select, fullW, y0, y1, pOffscreenService, selectAreaOffscreenObject, selectAreaRect, blockRects);
+	if (!skipTransparent) return masked;
+
+	if (!masked)
+		memset(select, 255, static_cast<size_t>(fullW) * (y1 - y0));
+	bool transparent = ClearTransparentBlocks(select, fullW, y0, y1, pOffscreenService, imageOffscreenObject,
+		selectAreaRect, blockRects);
+	return masked || transparent;
+}
 
-			PixelData pd;
-			row.getRGB(pixelIdx, pd.r, pd.g, pd.b);
-			pd.sortValue = GetSortValue(pd.r, pd.g, pd.b, params.sortKey);
-			pixelsWork.push_back(pd);
-			includedIndices.push_back(i);
+// SelectCoverage of every block rect over the select area mask `select`
+static void GetBlockCoverage(
+	const BYTE* select, int fullW, int fullH,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	std::vector<BYTE>& blockCoverage)
+{
+	blockCoverage.assign(blockRects.size(), kSelectCoverageNone);
+	for (size_t bi = 0; bi < blockRects.size(); ++bi)
+	{
+		const TriglavPlugInRect& br = blockRects[bi];
+		int top = (std::max)(0, static_cast<int>(br.top - selectAreaRect.top));
+		int bottom = (std::min)(fullH, static_cast<int>(br.bottom - selectAreaRect.top));
+		int bw = br.right - br.left;
+		int fx = br.left - selectAreaRect.left;
+		SelectCoverage coverage = kSelectCoverageNone;
+		for (int y = top; y < bottom; ++y)
+		{
+			SelectCoverage rowCoverage = MaskCoverage(select + static_cast<size_t>(y) * fullW + fx, bw);
+			coverage = (y == top) ? rowCoverage : CombineCoverage(coverage, rowCoverage);
+			if (coverage == kSelectCoveragePartial) break;
 		}
+		blockCoverage[bi] = static_cast<BYTE>(coverage);
+	}
+}
+
+// Bitmap backend: one OffscreenGetBitmap for the whole rect, then a row copy
+// out of the bitmap. Returns false if the host refused or, while the
+// channel order is not `verified` yet, the result does not match the blocks.
+static bool GatherImageBitmap(
+	SourceCache& cache,
+	HostBitmap& bitmap,
+	bool& verified,
+	TriglavPlugInBitmapService* pBitmapService,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	int rIdx, int gIdx, int bIdx)
+{
+	int fullW = cache.width, fullH = cache.height;
+	if (!bitmap.Valid() && !bitmap.Create(pBitmapService, fullW, fullH)) return false;
+	if ((*pOffscreenService).getBitmapProc == NULL) return false;
 
-		int count = static_cast<int>(pixelsWork.size());
-		if (count < 2) continue;
+	TriglavPlugInPoint bitmapPos; bitmapPos.x = 0; bitmapPos.y = 0;
+	TriglavPlugInPoint offscreenPos; offscreenPos.x = selectAreaRect.left; offscreenPos.y = selectAreaRect.top;
+	if ((*pOffscreenService).getBitmapProc(bitmap.object, &bitmapPos, imageOffscreenObject, &offscreenPos,
+		fullW, fullH, kTriglavPlugInOffscreenCopyModeImage) != kTriglavPlugInAPIResultSuccess)
+		return false;
 
-		// Sort by sort value
-		std::sort(pixelsWork.begin(), pixelsWork.end(),
-			[](const PixelData& a, const PixelData& b) {
-				return a.sortValue < b.sortValue;
-			});
+	ReadPixelsRGBFunc read = GetPixelCopyKernel().read;
+	for (int y = 0; y < fullH; ++y)
+		read(bitmap.Pixel(0, y), bitmap.layout, cache.image.data() + static_cast<size_t>(y) * fullW * 3, fullW);
+
+	if (!verified)
+	{
+		BlockMatch match = CompareBlocksRect(pOffscreenService, imageOffscreenObject, selectAreaRect, blockRects,
+			rIdx, gIdx, bIdx, cache.image.data(), fullW, 0, 0, fullW, fullH);
+		if (match == kBlockMatchDiffers) return false;
+		verified = (match == kBlockMatchConclusive);
+	}
+	return true;
+}
+
+// The cache's mask (see GatherMaskBlocks) and the coverage of every block.
+// Gathered again on its own when Skip Transparent changes.
+static void GatherSourceMask(
+	SourceCache& cache,
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	TriglavPlugInOffscreenObject selectAreaOffscreenObject, // NULL if no selection
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	bool skipTransparent)
+{
+	int fullW = cache.width, fullH = cache.height;
+	cache.skipTransparent = skipTransparent;
+	if (selectAreaOffscreenObject != NULL || skipTransparent)
+	{
+		cache.select.assign(static_cast<size_t>(fullW) * fullH, 0);
+		if (GatherMaskBlocks(cache.select.data(), fullW, 0, fullH, pOffscreenService, imageOffscreenObject,
+			selectAreaOffscreenObject, selectAreaRect, blockRects, skipTransparent))
+		{
+			GetBlockCoverage(cache.select.data(), fullW, fullH, selectAreaRect, blockRects, cache.blockCoverage);
+			return;
+		}
+	}
+	cache.select.clear();
+	cache.blockCoverage.clear();
+}
+
+static void GatherSource(
+	SourceCache& cache,
+	PixelIOState& io,
+	HostBitmap& bitmap,
+	TriglavPlugInBitmapService* pBitmapService, // NULL if the host has none
+	TriglavPlugInOffscreenService* pOffscreenService,
+	TriglavPlugInOffscreenObject imageOffscreenObject,
+	TriglavPlugInOffscreenObject selectAreaOffscreenObject, // NULL if no selection
+	const TriglavPlugInRect& selectAreaRect,
+	const std::vector<TriglavPlugInRect>& blockRects,
+	int rIdx, int gIdx, int bIdx,
+	bool skipTransparent)
+{
+	int fullW = selectAreaRect.right - selectAreaRect.left;
+	int fullH = selectAreaRect.bottom - selectAreaRect.top;
+	cache.width = fullW;
+	cache.height = fullH;
+	cache.image.assign(static_cast<size_t>(fullW) * fullH * 3, 0);
+	cache.select.clear();
+	cache.blockCoverage.clear();
+
+	PixelIOBackend backend = io.gather.Choose(pBitmapService != NULL && !io.bitmapRejected);
+	double start = PixelSortSeconds();
+	if (backend == kPixelIOBitmap &&
+		!GatherImageBitmap(cache, bitmap, io.gatherBitmapVerified, pBitmapService, pOffscreenService, imageOffscreenObject,
+			selectAreaRect, blockRects, rIdx, gIdx, bIdx))
+	{
+		PixelSortLog("[PixelSort] Bitmap gather failed; using block copies\n");
+		io.bitmapRejected = true;
+		backend = kPixelIOBlock;
+		start = PixelSortSeconds();
+	}
+	if (backend == kPixelIOBlock)
+	{
+		GatherImageBlocks(cache.image.data(), fullW, 0, fullH, pOffscreenService, imageOffscreenObject,
+			selectAreaRect, blockRects, rIdx, gIdx, bIdx);
+	}
+	double seconds = PixelSortSeconds() - start;
+	io.gather.Add(backend, seconds, static_cast<double>(fullW) * fullH);
+	PixelSortLog("[PixelSort] Gather (%s): %.2f ms\n", PixelIOBackendName(backend), seconds * 1000.0);
+
+	GatherSourceMask(cache, pOffscreenService, imageOffscreenObject, selectAreaOffscreenObject,
+		selectAreaRect, blockRects, skipTransparent);
+	cache.valid = true;
+}
+
+// ---------------------------------------------------------------------------
+// Write part of the full image back to the destination blocks
+// ---------------------------------------------------------------------------
+
+struct DestinationBlocks
+{
+	TriglavPlugInRecordSuite*             pRecordSuite;
+	TriglavPlugInHostObject               hostObject;
+	TriglavPlugInOffscreenService*        pOffscreenService;
+	TriglavPlugInOffscreenObject          offscreen;
+	TriglavPlugInRect                     selectAreaRect;
+	const std::vector<TriglavPlugInRect>* blockRects;
+	int                                   rIdx, gIdx, bIdx;
+	TriglavPlugInBitmapService*           pBitmapService; // NULL if the host has none
+	HostBitmap*                           bitmap;         // select-area bitmap, created on first use
+	PixelIOState*                         io;
+	const std::vector<BYTE>*              blockCoverage;  // SelectCoverage per block rect; empty if unknown
+};
+
+// A block with no selected pixel is never changed by a sort: the
+// destination keeps the source there, so it is neither written nor reported
+static bool BlockUnselected(const DestinationBlocks& dest, size_t bi)
+{
+	const std::vector<BYTE>& coverage = *dest.blockCoverage;
+	return !coverage.empty() && coverage[bi] == kSelectCoverageNone;
+}
+
+// Blocks of the destination with their memory, in select-area coordinates
+// (unselected blocks are left out)
+static void GetDestinationBlocks(const DestinationBlocks& dest, std::vector<DestinationBlock>& out)
+{
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	out.clear();
+	for (size_t bi = 0; bi < dest.blockRects->size(); ++bi)
+	{
+		if (BlockUnselected(dest, bi)) continue;
+
+		const TriglavPlugInRect& br = (*dest.blockRects)[bi];
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
+		(*dest.pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, dest.offscreen, &bpos);
+		if (imgAddr == NULL) continue;
+
+		DestinationBlock b;
+		b.rect.left = br.left - sar.left;   b.rect.top = br.top - sar.top;
+		b.rect.right = br.right - sar.left; b.rect.bottom = br.bottom - sar.top;
+		b.addr = static_cast<BYTE*>(imgAddr);
+		b.rowBytes = imgRB;
+		b.pixelBytes = imgPB;
+		out.push_back(b);
+	}
+}
+
+// Reports [x0, x1) x [y0, y1) (select-area coordinates) as updated, one
+// rect per selected block it touches
+static void ReportUpdatedRect(const DestinationBlocks& dest, int x0, int y0, int x1, int y1)
+{
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	for (size_t bi = 0; bi < dest.blockRects->size(); ++bi)
+	{
+		if (BlockUnselected(dest, bi)) continue;
+
+		const TriglavPlugInRect& br = (*dest.blockRects)[bi];
+		TriglavPlugInRect r;
+		r.left   = (std::max)(br.left,   sar.left + x0);
+		r.top    = (std::max)(br.top,    sar.top + y0);
+		r.right  = (std::min)(br.right,  sar.left + x1);
+		r.bottom = (std::min)(br.bottom, sar.top + y1);
+		if (r.left < r.right && r.top < r.bottom)
+			TriglavPlugInFilterRunUpdateDestinationOffscreenRect(dest.pRecordSuite, dest.hostObject, &r);
+	}
+}
+
+// Block backend: copies [x0, x1) x [y0, y1) into every selected block it touches
+static void ScatterRectBlocks(
+	const DestinationBlocks& dest,
+	const BYTE* fullImage,
+	int fullW,
+	int x0, int y0, int x1, int y1)
+{
+	WritePixelsRGBFunc write = GetPixelCopyKernel().write;
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	for (size_t bi = 0; bi < dest.blockRects->size(); ++bi)
+	{
+		if (BlockUnselected(dest, bi)) continue;
+
+		const TriglavPlugInRect& br = (*dest.blockRects)[bi];
+		TriglavPlugInRect r;
+		r.left   = (std::max)(br.left,   sar.left + x0);
+		r.top    = (std::max)(br.top,    sar.top + y0);
+		r.right  = (std::min)(br.right,  sar.left + x1);
+		r.bottom = (std::min)(br.bottom, sar.top + y1);
+		if (r.left >= r.right || r.top >= r.bottom) continue;
+
+		TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
+		TriglavPlugInRect tmpR;
+		TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
+		(*dest.pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, dest.offscreen, &bpos);
+		if (imgAddr == NULL) continue;
+
+		PixelLayout layout = MakePixelLayout(imgPB, dest.rIdx, dest.gIdx, dest.bIdx);
+		for (int y = r.top; y < r.bottom; ++y)
+		{
+			BYTE* dr = static_cast<BYTE*>(imgAddr) + (y - br.top) * imgRB + (r.left - br.left) * imgPB;
+			const BYTE* sr = fullImage + (static_cast<size_t>(y - sar.top) * fullW + (r.left - sar.left)) * 3;
+			write(sr, layout, dr, r.right - r.left);
+		}
+	}
+}
+
+// Bitmap backend: the rect goes into the select-area bitmap, then one
+// OffscreenSetBitmap. Returns false if the host refused or, while the
+// channel order is not verified yet, the result does not match.
+static bool ScatterRectBitmap(
+	const DestinationBlocks& dest,
+	const BYTE* fullImage,
+	int fullW,
+	int x0, int y0, int x1, int y1)
+{
+	HostBitmap& bitmap = *dest.bitmap;
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	if (!bitmap.Valid() && !bitmap.Create(dest.pBitmapService, fullW, sar.bottom - sar.top)) return false;
+	if ((*dest.pOffscreenService).setBitmapProc == NULL) return false;
+
+	WritePixelsRGBFunc write = GetPixelCopyKernel().write;
+	for (int y = y0; y < y1; ++y)
+		write(fullImage + (static_cast<size_t>(y) * fullW + x0) * 3, bitmap.layout, bitmap.Pixel(x0, y), x1 - x0);
+
+	TriglavPlugInPoint bitmapPos; bitmapPos.x = x0; bitmapPos.y = y0;
+	TriglavPlugInPoint offscreenPos; offscreenPos.x = sar.left + x0; offscreenPos.y = sar.top + y0;
+	if ((*dest.pOffscreenService).setBitmapProc(dest.offscreen, &offscreenPos, bitmap.object, &bitmapPos,
+		x1 - x0, y1 - y0, kTriglavPlugInOffscreenCopyModeImage) != kTriglavPlugInAPIResultSuccess)
+		return false;
+
+	bool& verified = dest.io->scatterBitmapVerified;
+	if (!verified)
+	{
+		BlockMatch match = CompareBlocksRect(dest.pOffscreenService, dest.offscreen, sar, *dest.blockRects,
+			dest.rIdx, dest.gIdx, dest.bIdx, fullImage, fullW, x0, y0, x1, y1);
+		if (match == kBlockMatchDiffers) return false;
+		verified = (match == kBlockMatchConclusive);
+	}
+	return true;
+}
+
+// Copies [x0, x1) x [y0, y1) of the packed RGB full image (coordinates
+// relative to the select area rect) to the destination with the faster
+// backend and reports each touched block part to the host as updated.
+static void ScatterRect(
+	const DestinationBlocks& dest,
+	const BYTE* fullImage,
+	int fullW,
+	int x0, int y0, int x1, int y1)
+{
+	PixelIOState& io = *dest.io;
+	PixelIOBackend backend = io.scatter.Choose(dest.pBitmapService != NULL && !io.bitmapRejected);
+	double start = PixelSortSeconds();
+	if (backend == kPixelIOBitmap && !ScatterRectBitmap(dest, fullImage, fullW, x0, y0, x1, y1))
+	{
+		PixelSortLog("[PixelSort] Bitmap scatter failed; using block copies\n");
+		io.bitmapRejected = true;
+		backend = kPixelIOBlock;
+		start = PixelSortSeconds();
+	}
+	if (backend == kPixelIOBlock)
+		ScatterRectBlocks(dest, fullImage, fullW, x0, y0, x1, y1);
+	io.scatter.Add(backend, PixelSortSeconds() - start, static_cast<double>(x1 - x0) * (y1 - y0));
+
+	ReportUpdatedRect(dest, x0, y0, x1, y1);
+}
+
+// Writes the unsorted source over the whole select area, unselected blocks
+// included. Passes leave rows and blocks with no selected pixel alone, so
+// after a mask change they would keep what a pass with the old mask sorted.
+static void RestoreSource(const DestinationBlocks& dest, const SourceCache& source)
+{
+	std::vector<BYTE> unknownCoverage;
+	DestinationBlocks everyBlock = dest;
+	everyBlock.blockCoverage = &unknownCoverage;
+	ScatterRect(everyBlock, source.image.data(), source.width, 0, 0, source.width, source.height);
+}
+
+// ---------------------------------------------------------------------------
+// Render target over the destination offscreen
+// ---------------------------------------------------------------------------
+
+// In-place rows go straight to the block memory; finished bands are
+// scattered, progress is reported to the host and Poll asks it whether to
+// go on.
+struct DestinationTarget : PixelSortRenderTarget
+{
+	const DestinationBlocks&                            dest;
+	std::vector<DestinationBlock>&                      blocks;    // refilled by BeginRows
+	std::vector<std::vector<const DestinationBlock*> >& rowBlocks; // per worker: blocks crossed by its row
+	TriglavPlugInInt                                    progressDone;
+
+	DestinationTarget(const DestinationBlocks& d, std::vector<DestinationBlock>& b,
+		std::vector<std::vector<const DestinationBlock*> >& rb)
+		: dest(d), blocks(b), rowBlocks(rb), progressDone(0)
+	{
+	}
+
+	virtual void BeginRows()
+	{
+		GetDestinationBlocks(dest, blocks);
+	}
+
+	// A row inside one block is sorted in the block memory itself; a row
+	// crossing several blocks is staged
+	virtual bool BeginRow(int worker, int y, const BYTE* src, bool staged, LineScratch& scratch, RowAccessor& row)
+	{
+		int fullW = dest.selectAreaRect.right - dest.selectAreaRect.left;
+		std::vector<const DestinationBlock*>& lineBlocks = rowBlocks[worker];
+		lineBlocks.clear();
+		for (size_t b = 0; b < blocks.size(); ++b)
+		{
+			if (blocks[b].rect.top <= y && y < blocks[b].rect.bottom)
+				lineBlocks.push_back(&blocks[b]);
+		}
+
+		row.length = fullW;
+
+		if (!staged && lineBlocks.size() == 1 &&
+			lineBlocks[0]->rect.left <= 0 && lineBlocks[0]->rect.right >= fullW)
+		{
+			const DestinationBlock& b = *lineBlocks[0];
+			row.imageBase = b.addr + (y - b.rect.top) * b.rowBytes - b.rect.left * b.pixelBytes;
+			row.imagePixelBytes = b.pixelBytes;
+			row.rIdx = dest.rIdx; row.gIdx = dest.gIdx; row.bIdx = dest.bIdx;
+			GetPixelCopyKernel().write(src, MakePixelLayout(b.pixelBytes, dest.rIdx, dest.gIdx, dest.bIdx), row.imageBase, fullW);
+			return false;
+		}
+
+		scratch.lineStaging.assign(src, src + fullW * 3);
+		row.imageBase = scratch.lineStaging.data();
+		row.imagePixelBytes = 3;
+		row.rIdx = 0; row.gIdx = 1; row.bIdx = 2;
+		return true;
+	}
+
+	// Writes the staged row to the blocks it crosses
+	virtual void FlushStagedRow(int worker, int y, const LineScratch& scratch)
+	{
+		int fullW = dest.selectAreaRect.right - dest.selectAreaRect.left;
+		const std::vector<const DestinationBlock*>& lineBlocks = rowBlocks[worker];
+		WritePixelsRGBFunc write = GetPixelCopyKernel().write;
+		const BYTE* st = scratch.lineStaging.data();
+		for (size_t bi = 0; bi < lineBlocks.size(); ++bi)
+		{
+			const DestinationBlock& b = *lineBlocks[bi];
+			int x0 = (std::max)(0, static_cast<int>(b.rect.left));
+			int x1 = (std::min)(fullW, static_cast<int>(b.rect.right));
+			BYTE* dp = b.addr + (y - b.rect.top) * b.rowBytes + (x0 - b.rect.left) * b.pixelBytes;
+			write(st + x0 * 3, MakePixelLayout(b.pixelBytes, dest.rIdx, dest.gIdx, dest.bIdx), dp, x1 - x0);
+		}
+	}
+
+	virtual void RowsUpdated(int y0, int y1)
+	{
+		ReportUpdatedRect(dest, 0, y0, dest.selectAreaRect.right - dest.selectAreaRect.left, y1);
+	}
 
-		// Reverse if requested
-		if (params.reverse)
+	virtual void WriteRect(const BYTE* image, int width, int x0, int y0, int x1, int y1)
+	{
+		ScatterRect(dest, image, width, x0, y0, x1, y1);
+	}
+
+	virtual void SetProgressTotal(int total)
+	{
+		TriglavPlugInFilterRunSetProgressTotal(dest.pRecordSuite, dest.hostObject, total);
+	}
+
+	virtual void SetProgressDone(int done)
+	{
+		progressDone = done;
+		TriglavPlugInFilterRunSetProgressDone(dest.pRecordSuite, dest.hostObject, progressDone);
+	}
+
+	virtual RenderStatus Poll()
+	{
+		TriglavPlugInInt processResult;
+		TriglavPlugInFilterRunProcess(dest.pRecordSuite, &processResult, dest.hostObject, kTriglavPlugInFilterRunProcessStateContinue);
+		if (processResult == kTriglavPlugInFilterRunProcessResultRestart) return kRenderStatusRestart;
+		if (processResult == kTriglavPlugInFilterRunProcessResultExit) return kRenderStatusExit;
+		return kRenderStatusDone;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Streaming passes (unrotated horizontal sorts of huge images)
+// ---------------------------------------------------------------------------
+
+// From this many pixels up, unrotated horizontal passes are streamed: rows
+// are read, keyed, sorted and written back one band of tile rows at a time,
+// so neither the source cache nor any full-image plane is allocated.
+static const double kStreamingMinPixels = 64.0 * 1024 * 1024;
+
+// Tile height assumed when the host does not report one
+static const int kDefaultTileHeight = 256;
+
+static bool UseStreaming(const PixelSortParams& params, int fullW, int fullH)
+{
+	return !ParamsUseAngle(params) && !ParamsUseColumns(params) &&
+		static_cast<double>(fullW) * fullH >= kStreamingMinPixels;
+}
+
+struct StreamSource
+{
+	TriglavPlugInOffscreenObject image;      // source offscreen; never written, so restarts re-read it
+	TriglavPlugInOffscreenObject selectArea; // NULL if no selection
+	int                          tileHeight;
+};
+
+// Waits for the pool's background job when it leaves scope, so an exception
+// on the calling thread never leaves workers on a band that is going away
+struct PoolJobWait
+{
+	PixelSortThreadPool& pool;
+
+	explicit PoolJobWait(PixelSortThreadPool& p) : pool(p) {}
+	~PoolJobWait() { try { pool.Wait(); } catch (...) {} }
+
+private:
+	PoolJobWait& operator=(const PoolJobWait&);
+};
+
+// Sorts the select area band by band from the source offscreen straight into
+// the destination blocks. Each band is pushed and polled for cancellation
+// like a RenderImage band; nothing is cached across passes. With
+// `restoreUnselected`, rows with no selected pixel are written with the
+// source instead of skipped (an earlier pass had another mask).
+//
+// Bands are pipelined: while the workers sort band b in the destination
+// blocks, this thread reports band b - 1 as updated and reads band b + 1
+// from the host, so host transfers overlap the sort. Every host call stays
+// on this thread, and worker 0 (this thread's scratch) sorts nothing.
+static RenderStatus RenderStreaming(
+	const RenderContext& ctx,
+	DestinationTarget& target,
+	const StreamSource& source,
+	StreamBand* bands, // two
+	const PixelSortParams& params,
+	bool restoreUnselected)
+{
+	const DestinationBlocks& dest = target.dest;
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	int fullW = sar.right - sar.left;
+	int fullH = sar.bottom - sar.top;
+	PixelSortThreadPool& pool = *ctx.pool;
+
+	// Bands are whole canvas tiles, with enough rows to keep every worker
+	// busy; `skew` lines the first band up with the tile grid
+	int tileH = (std::max)(1, source.tileHeight);
+	int minRows = kLinesPerTask * pool.GetThreadCount();
+	int bandRows = ((minRows + tileH - 1) / tileH) * tileH;
+	int skew = ((static_cast<int>(sar.top) % tileH) + tileH) % tileH;
+	int bandCount = (fullH + skew + bandRows - 1) / bandRows;
+
+	target.BeginRows();
+	target.SetProgressTotal(bandCount);
+	PixelSortLog("[PixelSort] Streaming %dx%d: %d bands of %d rows\n", fullW, fullH, bandCount, bandRows);
+
+	// Keys, spans and sorts share one worker loop, so they are timed as
+	// `sort`; with the read overlapped, that is only the wait for the workers
+	RenderStats stats = MakeRenderStats();
+	RenderStageClock clock;
+	std::vector<RenderCounts> workerCounts(ctx.scratches->size(), stats.counts);
+	ApplySortTuning(ctx);
+
+	// Rows of band b into band.image
+	auto gatherBand = [&](int b, StreamBand& band)
+	{
+		band.y0 = (std::max)(0, b * bandRows - skew);
+		band.y1 = (std::min)(fullH, (b + 1) * bandRows - skew);
+		band.image.resize(static_cast<size_t>(fullW) * (band.y1 - band.y0) * 3);
+		clock.Lap();
+		GatherImageBlocks(band.image.data(), fullW, band.y0, band.y1, dest.pOffscreenService, source.image,
+			sar, *dest.blockRects, dest.rIdx, dest.gIdx, dest.bIdx);
+		stats.gather += clock.Lap();
+	};
+
+	// Band b with its mask, ready to sort
+	auto readBand = [&](int b, StreamBand& band)
+	{
+		gatherBand(b, band);
+		band.hasSelection = false;
+		if (source.selectArea != NULL || params.skipTransparent)
 		{
-			std::reverse(pixelsWork.begin(), pixelsWork.end());
+			band.select.assign(static_cast<size_t>(fullW) * (band.y1 - band.y0), 0);
+			band.hasSelection = GatherMaskBlocks(band.select.data(), fullW, band.y0, band.y1, dest.pOffscreenService,
+				source.image, source.selectArea, sar, *dest.blockRects, params.skipTransparent);
+			stats.gather += clock.Lap();
 		}
+	};
 
-		// Apply jitter if requested
-		if (params.jitter > 0 && count > 1)
+	// An image-wide Edges threshold needs every row's gradient first, so the
+	// source is read once more for the statistics alone
+	int edgeLimit = kEdgeLimitPerLine;
+	if (ParamsUseImageEdgeLimit(params))
+	{
+		EdgeStats edgeStats = MakeEdgeStats();
+		StreamBand& band = bands[0];
+		KeyPlane& keyPlane = band.keyPlane;
+		for (int b = 0; b < bandCount; ++b)
 		{
-			for (int i = 0; i < count; ++i)
+			gatherBand(b, band);
+			int rows = band.y1 - band.y0;
+			keyPlane.Allocate(fullW, rows, kSortKeyBrightness, kIntervalModeThreshold);
+			pool.ParallelFor(rows, kLinesPerTask, [&](int, int begin, int end)
 			{
-				std::uniform_int_distribution<int> dist(-params.jitter, params.jitter);
-				int offset = dist(rng);
-				int j = (std::max)(0, (std::min)(count - 1, i + offset));
-				std::swap(pixelsWork[i], pixelsWork[j]);
-			}
+				keyPlane.BuildRows(band.image.data(), kSortKeyBrightness, begin, end);
+			});
+			AddEdgeStats(edgeStats, SumLineEdgeStats(ctx, rows, [&](int i) { return keyPlane.Row(i); }));
+			stats.spans += clock.Lap();
 		}
+		edgeLimit = EdgeSplitLimit(edgeStats);
+	}
 
-		// Write sorted pixels back
-		if (selectArea != NULL)
+	SortLineKernel<RowAccessor>       blockKernel  = SelectSortLineKernel<RowAccessor>(params);
+	SortLineKernel<PackedRowAccessor> packedKernel = SelectSortLineKernel<PackedRowAccessor>(params);
+
+	// Keys, spans and the sort of `band`, row by row. Seeds and waves use
+	// the select-area row, so the result matches an unstreamed pass.
+	StreamBand* sorting = NULL;
+	PixelSortThreadPool::RangeFunc sortRows = [&](int worker, int begin, int end)
+	{
+		StreamBand& band = *sorting;
+		LineScratch& scratch = (*ctx.scratches)[worker];
+		RenderCounts counts = { 0, 0, 0 };
+		band.keyPlane.BuildRows(band.image.data(), params.sortKey, begin, end);
+		for (int i = begin; i < end; ++i)
 		{
-			// Write back only to included positions
-			for (int i = 0; i < count; ++i)
+			int y = band.y0 + i;
+			const BYTE* src = band.image.data() + static_cast<size_t>(i) * fullW * 3;
+			const BYTE* selLine = band.hasSelection ? band.select.data() + static_cast<size_t>(i) * fullW : NULL;
+			RowAccessor line;
+			if (selLine != NULL)
 			{
-				int pixelIdx = spanStart + includedIndices[i];
-				BYTE sel = selectArea[pixelIdx * selectPixelStride];
-				if (sel == 255)
+				SelectCoverage coverage = MaskCoverage(selLine, fullW);
+				if (coverage == kSelectCoverageNone)
 				{
-					row.setRGB(pixelIdx, pixelsWork[i].r, pixelsWork[i].g, pixelsWork[i].b);
-				}
-				else if (sel > 0)
-				{
-					// Partial selection: blend original and sorted pixel
-					BYTE origR, origG, origB;
-					row.getRGB(pixelIdx, origR, origG, origB);
-					int alpha = sel;
-					BYTE finalR = static_cast<BYTE>(((pixelsWork[i].r - origR) * alpha / 255) + origR);
-					BYTE finalG = static_cast<BYTE>(((pixelsWork[i].g - origG) * alpha / 255) + origG);
-					BYTE finalB = static_cast<BYTE>(((pixelsWork[i].b - origB) * alpha / 255) + origB);
-					row.setRGB(pixelIdx, finalR, finalG, finalB);
+					// Staged as is: the row is written unsorted
+					if (restoreUnselected && target.BeginRow(worker, y, src, true, scratch, line))
+						target.FlushStagedRow(worker, y, scratch);
+					continue;
 				}
+				if (coverage == kSelectCoverageFull) selLine = NULL;
+			}
+
+			DetectSpans(band.keyPlane.Row(i), band.keyPlane.BrightnessRow(i), params, edgeLimit, y, scratch.rowSpans);
+			CountSortedLine(counts, scratch.rowSpans);
+
+			if (target.BeginRow(worker, y, src, selLine != NULL, scratch, line))
+			{
+				packedKernel.Sort(StagedRow(scratch, fullW), band.keyPlane.Row(i), scratch.rowSpans, params, selLine, y, scratch);
+				if (selLine != NULL)
+					BlendStagedRow(src, selLine, fullW, scratch);
+				target.FlushStagedRow(worker, y, scratch);
+			}
+			else
+			{
+				blockKernel.Sort(line, band.keyPlane.Row(i), scratch.rowSpans, params, selLine, y, scratch);
 			}
 		}
-		else
+		AddRenderCounts(workerCounts[worker], counts);
+	};
+
+	// Band b is in the destination: report it and its progress
+	auto finishBand = [&](int b)
+	{
+		const StreamBand& band = bands[b & 1];
+		target.RowsUpdated(band.y0, band.y1);
+		target.SetProgressDone(b + 1);
+		stats.write += clock.Lap();
+	};
+
+	RenderStatus status = kRenderStatusDone;
+	bool cancellable = ctx.cancellable;
+	PoolJobWait waitOnExit(pool);
+	readBand(0, bands[0]);
+	for (int b = 0; b < bandCount; ++b)
+	{
+		sorting = &bands[b & 1];
+		sorting->keyPlane.Allocate(fullW, sorting->y1 - sorting->y0, params.sortKey, params.intervalMode);
+		pool.BeginParallelFor(sorting->y1 - sorting->y0, kLinesPerTask, sortRows);
+
+		if (b > 0)
+			finishBand(b - 1);
+		if (b + 1 < bandCount)
+			readBand(b + 1, bands[(b + 1) & 1]);
+
+		clock.Lap();
+		pool.Wait();
+		stats.sort += clock.Lap();
+
+		if (cancellable && b + 1 < bandCount)
 		{
-			for (int i = 0; i < count; ++i)
+			RenderStatus polled = target.Poll();
+			if (polled == kRenderStatusRestart)
 			{
-				int pixelIdx = spanStart + includedIndices[i];
-				row.setRGB(pixelIdx, pixelsWork[i].r, pixelsWork[i].g, pixelsWork[i].b);
+				PixelSortLog("[PixelSort] Streaming cancelled after band %d/%d\n", b + 1, bandCount);
+				status = kRenderStatusRestart;
+				break;
+			}
+			if (polled == kRenderStatusExit)
+			{
+				// The dialog closed; finish so the destination is complete
+				status = kRenderStatusExit;
+				cancellable = false;
 			}
 		}
 	}
+	if (status != kRenderStatusRestart)
+		finishBand(bandCount - 1);
+
+	if (ctx.stats != NULL)
+	{
+		RenderStats& total = *ctx.stats;
+		total.gather += stats.gather;
+		total.spans += stats.spans;
+		total.sort += stats.sort;
+		total.write += stats.write;
+		for (size_t w = 0; w < workerCounts.size(); ++w)
+			AddRenderCounts(total.counts, workerCounts[w]);
+	}
+	return status;
+}
+
+// ---------------------------------------------------------------------------
+// Render cache
+// ---------------------------------------------------------------------------
+
+// Keeps the finished full-resolution result of `params`: fullImage if the
+// pass left it there, else the destination read back (in-place passes)
+static void CacheRenderResult(
+	RenderCache& cache,
+	const PixelSortParams& params,
+	const StageCache& stages,
+	const DestinationBlocks& dest)
+{
+	const TriglavPlugInRect& sar = dest.selectAreaRect;
+	int fullW = sar.right - sar.left;
+	int fullH = sar.bottom - sar.top;
+	std::vector<BYTE>* image = cache.Insert(params, static_cast<size_t>(fullW) * fullH * 3);
+	if (image == NULL) return;
+
+	if (stages.imageValid)
+	{
+		memcpy(image->data(), stages.fullImage.data(), image->size());
+	}
+	else
+	{
+		GatherImageBlocks(image->data(), fullW, 0, fullH, dest.pOffscreenService, dest.offscreen,
+			sar, *dest.blockRects, dest.rIdx, dest.gIdx, dest.bIdx);
+	}
+	PixelSortLog("[PixelSort] Render cache: %d results, %.1f MB\n", cache.GetCount(),
+		static_cast<double>(cache.GetBytes()) / (1024.0 * 1024.0));
+}
+
+// ---------------------------------------------------------------------------
+// Render stats CSV
+// ---------------------------------------------------------------------------
+
+// Opt in with the PIXELSORT_STATS_CSV environment variable: every pass's
+// summary is then appended to that file as one CSV row
+static std::ofstream* s_statsCsv = NULL;
+
+#if PIXELSORT_RENDER_STATS
+static void WriteRenderStatsCsv(const char* pass, int width, int height, const RenderStats& stats)
+{
+	char row[512];
+	snprintf(row, sizeof(row), "%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld,%lld,%lld,%d\n",
+		pass, width, height, stats.gather * 1000.0, stats.layout * 1000.0, stats.keys * 1000.0,
+		stats.spans * 1000.0, stats.sort * 1000.0, stats.blend * 1000.0, stats.write * 1000.0,
+		stats.counts.lines, stats.counts.spans, stats.counts.pixels, stats.restarts);
+	*s_statsCsv << row << std::flush;
+}
+#endif
+
+static void OpenRenderStatsCsv()
+{
+#if PIXELSORT_RENDER_STATS
+	char path[MAX_PATH];
+	DWORD length = GetEnvironmentVariableA("PIXELSORT_STATS_CSV", path, MAX_PATH);
+	if (length == 0 || length >= MAX_PATH || s_statsCsv != NULL) return;
+
+	s_statsCsv = new std::ofstream(path, std::ios::out | std::ios::app);
+	if (!s_statsCsv->is_open())
+	{
+		PixelSortLog("[PixelSort] WARNING: cannot open stats CSV %s\n", path);
+		delete s_statsCsv;
+		s_statsCsv = NULL;
+		return;
+	}
+	if (s_statsCsv->tellp() == std::streampos(0))
+		*s_statsCsv << "pass,width,height,gather_ms,layout_ms,keys_ms,spans_ms,sort_ms,blend_ms,write_ms,lines,spans,pixels,restarts\n";
+	SetRenderStatsSink(WriteRenderStatsCsv);
+	PixelSortLog("[PixelSort] Stats CSV: %s\n", path);
+#endif
+}
+
+static void CloseRenderStatsCsv()
+{
+	SetRenderStatsSink(NULL);
+	delete s_statsCsv;
+	s_statsCsv = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Tuning profile
+// ---------------------------------------------------------------------------
+
+static const char kTuningProfileName[] = "PixelSort.tuning";
+
+// Where a profile may live, in the order they are read and tried for writing
+enum TuningProfileFolder
+{
+	kTuningProfileBesideDll   = 0, // the plug-in folder
+	kTuningProfilePerUser     = 1, // %LOCALAPPDATA%\PixelSort, for plug-in folders a user cannot write
+	kTuningProfileFolderCount = 2
+};
+
+static bool GetTuningProfilePath(TuningProfileFolder folder, char* path, DWORD size)
+{
+	size_t dirLength = 0;
+	if (folder == kTuningProfileBesideDll)
+	{
+		HMODULE module = NULL;
+		if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+			reinterpret_cast<LPCSTR>(&GetTuningProfilePath), &module))
+			return false;
+		DWORD length = GetModuleFileNameA(module, path, size);
+		if (length == 0 || length >= size) return false;
+		const char* slash = strrchr(path, '\\');
+		dirLength = (slash != NULL) ? static_cast<size_t>(slash + 1 - path) : 0;
+	}
+	else
+	{
+		static const char subfolder[] = "\\PixelSort\\";
+		DWORD length = GetEnvironmentVariableA("LOCALAPPDATA", path, size);
+		if (length == 0 || length >= size || length + sizeof(subfolder) > size) return false;
+		memcpy(path + length, subfolder, sizeof(subfolder));
+		dirLength = length + sizeof(subfolder) - 1;
+	}
+	if (dirLength + sizeof(kTuningProfileName) > size) return false;
+	memcpy(path + dirLength, kTuningProfileName, sizeof(kTuningProfileName));
+	return true;
+}
+
+// Whether `path` can be written (its folder is created if missing), without
+// leaving a new file behind
+static bool CanWriteTuningProfile(const char* path)
+{
+	char folder[MAX_PATH];
+	strcpy_s(folder, sizeof(folder), path);
+	char* slash = strrchr(folder, '\\');
+	if (slash != NULL)
+	{
+		*slash = '\0';
+		CreateDirectoryA(folder, NULL); // fails harmlessly if it exists
+	}
+
+	bool existed = GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+	FILE* f = NULL;
+	if (fopen_s(&f, path, "a") != 0 || f == NULL) return false;
+	fclose(f);
+	if (!existed)
+		DeleteFileA(path);
+	return true;
+}
+
+// The profile of this machine, read from the first folder that has one
+// measured here with this sort device; the built-in defaults if none does.
+// Calibrating blocks for seconds, so it only happens on demand: with
+// PIXELSORT_CALIBRATE=1 (the profile is then written to the first writable
+// folder) or with PixelSortBench --calibrate. PIXELSORT_CALIBRATE=0 keeps
+// the defaults even if a profile matches.
+static RenderTuning ReadOrCalibrateTuning(PixelSortDevice* device)
+{
+	RenderTuning tuning = MakeDefaultTuning();
+	char value[16];
+	DWORD length = GetEnvironmentVariableA("PIXELSORT_CALIBRATE", value, sizeof(value));
+	bool forced = length > 0 && length < sizeof(value) && strcmp(value, "1") == 0;
+	if (length > 0 && length < sizeof(value) && strcmp(value, "0") == 0)
+	{
+		LogRenderTuning("defaults, PIXELSORT_CALIBRATE=0", tuning);
+		return tuning;
+	}
+
+	char paths[kTuningProfileFolderCount][MAX_PATH];
+	bool hasPath[kTuningProfileFolderCount];
+	for (int f = 0; f < kTuningProfileFolderCount; ++f)
+	{
+		hasPath[f] = GetTuningProfilePath(static_cast<TuningProfileFolder>(f), paths[f], MAX_PATH);
+		RenderTuning loaded = MakeDefaultTuning();
+		if (!forced && hasPath[f] && LoadRenderTuning(paths[f], loaded) && TuningMatchesMachine(loaded, device))
+		{
+			PixelSortLog("[PixelSort] Tuning profile: %s\n", paths[f]);
+			LogRenderTuning("profile", loaded);
+			return loaded;
+		}
+	}
+	if (!forced)
+	{
+		PixelSortLog("[PixelSort] No %s for this machine; set PIXELSORT_CALIBRATE=1 to measure one\n", kTuningProfileName);
+		LogRenderTuning("defaults", tuning);
+		return tuning;
+	}
+
+	const char* savePath = NULL;
+	for (int f = 0; f < kTuningProfileFolderCount && savePath == NULL; ++f)
+	{
+		if (hasPath[f] && CanWriteTuningProfile(paths[f]))
+			savePath = paths[f];
+	}
+
+	PixelSortLog("[PixelSort] Calibrating render engines (PIXELSORT_CALIBRATE=1)...\n");
+	tuning = CalibrateRenderTuning(device);
+	LogRenderTuning("calibrated", tuning);
+	if (savePath != NULL && SaveRenderTuning(savePath, tuning))
+		PixelSortLog("[PixelSort] Tuning profile written: %s\n", savePath);
+	else
+		PixelSortLog("[PixelSort] WARNING: no writable folder for %s; the calibration is not kept\n", kTuningProfileName);
+	return tuning;
 }
 
 // ---------------------------------------------------------------------------
 // Plugin main entry point
 // ---------------------------------------------------------------------------
 
+// Log lines go to the debugger output
+static void PixelSortLogToDebugger(const char* line)
+{
+	OutputDebugStringA(line);
+}
+
 void TRIGLAV_PLUGIN_API TriglavPluginCall(
 	TriglavPlugInInt* result,
 	TriglavPlugInPtr* data,
@@ -289,7 +1512,9 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 		// =================================================================
 		if (selector == kTriglavPlugInSelectorModuleInitialize)
 		{
+			PixelSortSetLogSink(PixelSortLogToDebugger);
 			PixelSortLog("[PixelSort] ModuleInitialize\n");
+			OpenRenderStatsCsv();
 
 			TriglavPlugInModuleInitializeRecord* pModuleInitializeRecord = (*pluginServer).recordSuite.moduleInitializeRecord;
 			TriglavPlugInStringService* pStringService = (*pluginServer).serviceSuite.stringService;
@@ -318,6 +1543,22 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 			pInfo->params = MakeDefaultParams();
 			pInfo->pPropertyService = NULL;
 			pInfo->pPropertyService2 = NULL;
+			pInfo->pThreadPool = NULL;
+			pInfo->pSortDevice = NULL;
+			pInfo->sortDeviceTried = false;
+			pInfo->tuning = MakeDefaultTuning();
+			pInfo->pWorkspace = NULL;
+			pInfo->source.Release();
+			pInfo->io.bitmapRejected = false;
+			pInfo->io.gatherBitmapVerified = false;
+			pInfo->io.scatterBitmapVerified = false;
+
+			// Pick the key, pixel copy and edge kernels for this CPU once, before
+			// any filter runs
+			PixelSortLog("[PixelSort] Key kernel: %s\n", GetKeyKernel().name);
+			PixelSortLog("[PixelSort] Pixel copy kernel: %s\n", GetPixelCopyKernel().name);
+			PixelSortLog("[PixelSort] Edge kernel: %s\n", GetEdgeKernel().name);
+
 			*data = pInfo;
 			*result = kTriglavPlugInCallResultSuccess;
 		}
@@ -327,7 +1568,14 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 		else if (selector == kTriglavPlugInSelectorModuleTerminate)
 		{
 			PixelSortLog("[PixelSort] ModuleTerminate\n");
+			CloseRenderStatsCsv();
 			PixelSortFilterInfo* pInfo = static_cast<PixelSortFilterInfo*>(*data);
+			if (pInfo != NULL)
+			{
+				delete pInfo->pThreadPool;
+				delete pInfo->pSortDevice;
+				delete pInfo->pWorkspace;
+			}
 			delete pInfo;
 			*data = NULL;
 			*result = kTriglavPlugInCallResultSuccess;
@@ -463,6 +1711,32 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 				}
 			}
 
+			// --- Edge Threshold (Enumeration: Per Line, Per Image; Edges mode only) ---
+			{
+				TriglavPlugInStringObject caption = NULL;
+				(*pStringService).createWithStringIDProc(&caption, kStringIDItemCaptionEdgeScope, hostObject);
+				(*pPropertyService).addItemProc(propertyObject, kItemKeyEdgeScope,
+					kTriglavPlugInPropertyValueTypeEnumeration,
+					kTriglavPlugInPropertyValueKindDefault,
+					kTriglavPlugInPropertyInputKindDefault, caption, 'e');
+				(*pStringService).releaseProc(caption);
+
+				if (pPropertyService2 != NULL)
+				{
+					TriglavPlugInStringObject s = NULL;
+					(*pStringService).createWithAsciiStringProc(&s, "Per Line", 8);
+					(*pPropertyService2).addEnumerationItemProc(propertyObject, kItemKeyEdgeScope, 0, s, 'l');
+					(*pStringService).releaseProc(s);
+
+					(*pStringService).createWithAsciiStringProc(&s, "Per Image", 9);
+					(*pPropertyService2).addEnumerationItemProc(propertyObject, kItemKeyEdgeScope, 1, s, 'i');
+					(*pStringService).releaseProc(s);
+
+					(*pPropertyService2).setEnumerationValueProc(propertyObject, kItemKeyEdgeScope, 0);
+					(*pPropertyService2).setEnumerationDefaultValueProc(propertyObject, kItemKeyEdgeScope, 0);
+				}
+			}
+
 			// --- Lower Threshold (Integer 0-255, default 64) ---
 			{
 				TriglavPlugInStringObject caption = NULL;
@@ -581,6 +1855,34 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 				(*pPropertyService).setIntegerMaxValueProc(propertyObject, kItemKeyFalloff, 100);
 			}
 
+			// --- Skip Transparent (Boolean, default false) ---
+			{
+				TriglavPlugInStringObject caption = NULL;
+				(*pStringService).createWithStringIDProc(&caption, kStringIDItemCaptionSkipTransparent, hostObject);
+				(*pPropertyService).addItemProc(propertyObject, kItemKeySkipTransparent,
+					kTriglavPlugInPropertyValueTypeBoolean,
+					kTriglavPlugInPropertyValueKindDefault,
+					kTriglavPlugInPropertyInputKindDefault, caption, 't');
+				(*pStringService).releaseProc(caption);
+				(*pPropertyService).setBooleanValueProc(propertyObject, kItemKeySkipTransparent, kTriglavPlugInBoolFalse);
+				(*pPropertyService).setBooleanDefaultValueProc(propertyObject, kItemKeySkipTransparent, kTriglavPlugInBoolFalse);
+			}
+
+			// --- Seed (Integer 0-99999, default 42): random spans, falloff and jitter ---
+			{
+				TriglavPlugInStringObject caption = NULL;
+				(*pStringService).createWithStringIDProc(&caption, kStringIDItemCaptionSeed, hostObject);
+				(*pPropertyService).addItemProc(propertyObject, kItemKeySeed,
+					kTriglavPlugInPropertyValueTypeInteger,
+					kTriglavPlugInPropertyValueKindDefault,
+					kTriglavPlugInPropertyInputKindDefault, caption, 's');
+				(*pStringService).releaseProc(caption);
+				(*pPropertyService).setIntegerValueProc(propertyObject, kItemKeySeed, kPixelSortDefaultSeed);
+				(*pPropertyService).setIntegerDefaultValueProc(propertyObject, kItemKeySeed, kPixelSortDefaultSeed);
+				(*pPropertyService).setIntegerMinValueProc(propertyObject, kItemKeySeed, 0);
+				(*pPropertyService).setIntegerMaxValueProc(propertyObject, kItemKeySeed, 99999);
+			}
+
 			// Set property and callback
 			TriglavPlugInFilterInitializeSetProperty(pRecordSuite, hostObject, propertyObject);
 			TriglavPlugInFilterInitializeSetPropertyCallBack(pRecordSuite, hostObject, TriglavPlugInFilterPropertyCallBack, *data);
@@ -594,6 +1896,13 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 		else if (selector == kTriglavPlugInSelectorFilterTerminate)
 		{
 			PixelSortLog("[PixelSort] FilterTerminate\n");
+			PixelSortFilterInfo* pInfo = static_cast<PixelSortFilterInfo*>(*data);
+			if (pInfo != NULL)
+			{
+				pInfo->source.Release();
+				delete pInfo->pWorkspace;
+				pInfo->pWorkspace = NULL;
+			}
 			*result = kTriglavPlugInCallResultSuccess;
 		}
 		// =================================================================
@@ -607,6 +1916,7 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 			TriglavPlugInOffscreenService* pOffscreenService = (*pluginServer).serviceSuite.offscreenService;
 			TriglavPlugInPropertyService*  pPropertyService  = (*pluginServer).serviceSuite.propertyService;
 			TriglavPlugInPropertyService2* pPropertyService2 = (*pluginServer).serviceSuite.propertyService2;
+			TriglavPlugInBitmapService*    pBitmapService    = (*pluginServer).serviceSuite.bitmapService;
 
 			if (TriglavPlugInGetFilterRunRecord(pRecordSuite) == NULL ||
 				pOffscreenService == NULL || pPropertyService == NULL)
@@ -642,24 +1952,101 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 				(*pOffscreenService).getBlockRectProc(&blockRects[i], i, destinationOffscreenObject, &selectAreaRect);
 			}
 
-			TriglavPlugInFilterRunSetProgressTotal(pRecordSuite, (*pluginServer).hostObject, blockRectCount);
-
 			PixelSortFilterInfo* pInfo = static_cast<PixelSortFilterInfo*>(*data);
 			pInfo->pPropertyService = pPropertyService;
 			pInfo->pPropertyService2 = pPropertyService2;
 			pInfo->params = MakeDefaultParams();
 
-			// Reusable work buffers
-			std::vector<Span>      spansWork;
-			std::vector<float>     brightnessWork;
-			std::vector<PixelData> pixelsWork;
-			std::vector<int>       includedIndices;
+			if (!pInfo->sortDeviceTried)
+			{
+				pInfo->sortDeviceTried = true;
+				pInfo->pSortDevice = CreatePixelSortDevice();
+				if (pInfo->pSortDevice != NULL)
+					PixelSortLog("[PixelSort] GPU sort: %s\n", pInfo->pSortDevice->GetName());
+				else
+					PixelSortLog("[PixelSort] GPU sort: unavailable\n");
+			}
+			if (pInfo->pThreadPool == NULL)
+			{
+				// The profile picks the pool size, so it comes first. Only an
+				// existing profile is read here; calibrating is on demand.
+				pInfo->tuning = ReadOrCalibrateTuning(pInfo->pSortDevice);
+				pInfo->pThreadPool = new PixelSortThreadPool(pInfo->tuning.threadCount);
+				PixelSortLog("[PixelSort] Worker threads: %d\n", pInfo->pThreadPool->GetThreadCount());
+			}
+			PixelSortThreadPool& pool = *pInfo->pThreadPool;
+
+			// The source pixels do not change while the dialog is open, so
+			// they are gathered on the first unstreamed pass and reused on
+			// restarts. They come from the source offscreen: streaming passes
+			// may already have written the destination.
+			SourceCache& source = pInfo->source;
+			source.valid = false;
+			source.blockCoverage.clear();
+
+			// Work buffers keep their capacity from earlier runs; only the
+			// cached stages are dropped
+			if (pInfo->pWorkspace == NULL)
+				pInfo->pWorkspace = new PixelSortWorkspace;
+			PixelSortWorkspace& workspace = *pInfo->pWorkspace;
+			workspace.Reset(pool.GetThreadCount());
+			std::vector<LineScratch>& scratches = workspace.scratches;
+			StageCache& stages = workspace.stages;
+
+			// Previews of large images are first rendered on a downsampled
+			// proxy, then refined at full resolution
+			SourceCache& proxySource = workspace.proxySource;
+			StageCache& proxyStages = workspace.proxyStages;
+			std::vector<BYTE>& proxyUpsampled = workspace.proxyUpsampled;
+
+			// Bulk transfers go through one bitmap of the select area rect
+			HostBitmap bitmap;
+
+			// Streaming passes read tile bands of the untouched source
+			StreamSource streamSource;
+			streamSource.image = sourceOffscreenObject;
+			streamSource.selectArea = selectAreaOffscreenObject;
+			TriglavPlugInInt tileHeight = 0;
+			if ((*pOffscreenService).getTileHeightProc == NULL ||
+				(*pOffscreenService).getTileHeightProc(&tileHeight, sourceOffscreenObject) != kTriglavPlugInAPIResultSuccess ||
+				tileHeight <= 0)
+				tileHeight = kDefaultTileHeight;
+			streamSource.tileHeight = tileHeight;
+
+			DestinationBlocks dest;
+			dest.pRecordSuite = pRecordSuite;
+			dest.hostObject = (*pluginServer).hostObject;
+			dest.pOffscreenService = pOffscreenService;
+			dest.offscreen = destinationOffscreenObject;
+			dest.selectAreaRect = selectAreaRect;
+			dest.blockRects = &blockRects;
+			dest.rIdx = rIdx; dest.gIdx = gIdx; dest.bIdx = bIdx;
+			dest.pBitmapService = pBitmapService;
+			dest.bitmap = &bitmap;
+			dest.io = &pInfo->io;
+			dest.blockCoverage = &source.blockCoverage;
 
 			bool restart = true;
+			int sessionRestarts = 0; // restarts in this dialog session
+
+			// The Skip Transparent value of the last pass that wrote the
+			// destination. Passes never touch pixels their mask leaves out,
+			// so a pass with the other value first puts the source back.
+			bool destinationWritten = false;
+			bool destinationSkipTransparent = false;
 			PixelSortParams currentParams = MakeDefaultParams();
-			std::mt19937 rng(42); // fixed seed for deterministic preview
 
-			TriglavPlugInInt blockIndex = 0;
+			DestinationTarget target(dest, workspace.destBlocks, workspace.rowBlocks);
+
+			RenderContext renderCtx;
+			renderCtx.pool = &pool;
+			renderCtx.scratches = &scratches;
+			renderCtx.device = pInfo->pSortDevice;
+			renderCtx.tuning = &pInfo->tuning;
+			renderCtx.target = &target;
+			renderCtx.pushBands = true;
+			renderCtx.cancellable = true;
+			renderCtx.stats = NULL;
 			while (true)
 			{
 				if (restart)
@@ -670,17 +2057,17 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 					TriglavPlugInFilterRunProcess(pRecordSuite, &processResult, (*pluginServer).hostObject, kTriglavPlugInFilterRunProcessStateStart);
 					if (processResult == kTriglavPlugInFilterRunProcessResultExit) break;
 
-					blockIndex = 0;
+					target.progressDone = 0;
 					ReadAllProperties(pInfo, propertyObject);
 					currentParams = pInfo->params;
-					rng.seed(42); // re-seed for consistent preview
 
-					PixelSortLog("[PixelSort] Params: dir=%d key=%d mode=%d lo=%d hi=%d rev=%d jit=%d smin=%d smax=%d ang=%d fall=%d\n",
+					PixelSortLog("[PixelSort] Params: dir=%d key=%d mode=%d lo=%d hi=%d rev=%d jit=%d smin=%d smax=%d ang=%d fall=%d edge=%d alpha=%d seed=%d\n",
 						currentParams.direction, currentParams.sortKey, currentParams.intervalMode,
 						currentParams.lowerThreshold, currentParams.upperThreshold,
 						currentParams.reverse ? 1 : 0, currentParams.jitter,
 						currentParams.spanMin, currentParams.spanMax, currentParams.angle,
-						currentParams.falloff);
+						currentParams.falloff, currentParams.edgeScope, currentParams.skipTransparent ? 1 : 0,
+						currentParams.seed);
 
 					// ----------------------------------------------------------
 					// Full-image processing (avoids block fragmentation)
@@ -693,253 +2080,147 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 						{
 							PixelSortLog("[PixelSort] Full-image: %dx%d ang=%d\n", fullW, fullH, currentParams.angle);
 
-							// Gather full image from destination blocks (RGB)
-							std::vector<BYTE> fullImage(fullW * fullH * 3, 0);
-							std::vector<BYTE> origImage;
-							std::vector<BYTE> fullSelect;
-							bool hasSelection = (selectAreaOffscreenObject != NULL);
+							// One summary per pass; the source gather counts toward the first
+							RenderStats passStats = MakeRenderStats();
+							passStats.restarts = sessionRestarts;
+							renderCtx.stats = &passStats;
 
-							for (TriglavPlugInInt bi = 0; bi < blockRectCount; ++bi)
+							RenderStatus status = kRenderStatusDone;
+							bool maskChanged = destinationWritten && destinationSkipTransparent != currentParams.skipTransparent;
+							destinationWritten = true;
+							destinationSkipTransparent = currentParams.skipTransparent;
+							if (UseStreaming(currentParams, fullW, fullH))
 							{
-								TriglavPlugInRect br = blockRects[bi];
-								TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
-								TriglavPlugInRect tmpR;
-								TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
-								(*pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, destinationOffscreenObject, &bpos);
-								if (imgAddr != NULL)
+								// Huge row sorts: no source cache and no proxy. Block
+								// coverage of a cached source with another mask would
+								// leave out blocks this mask selects.
+								if (source.valid && source.skipTransparent != currentParams.skipTransparent)
+									source.blockCoverage.clear();
+								status = RenderStreaming(renderCtx, target, streamSource, workspace.stream, currentParams, maskChanged);
+								LogRenderStats("stream", fullW, fullH, passStats);
+							}
+							else
+							{
+								RenderStageClock gatherClock;
+								if (!source.valid)
 								{
-									int bw = br.right - br.left, bh = br.bottom - br.top;
-									for (int y = 0; y < bh; ++y)
-									{
-										BYTE* sr = static_cast<BYTE*>(imgAddr) + y * imgRB;
-										int fy = (br.top - selectAreaRect.top) + y;
-										for (int x = 0; x < bw; ++x)
-										{
-											int fx = (br.left - selectAreaRect.left) + x;
-											BYTE* sp = sr + x * imgPB;
-											int idx = (fy * fullW + fx) * 3;
-											fullImage[idx + 0] = sp[rIdx];
-											fullImage[idx + 1] = sp[gIdx];
-											fullImage[idx + 2] = sp[bIdx];
-										}
-									}
+									GatherSource(source, pInfo->io, bitmap, pBitmapService, pOffscreenService,
+										sourceOffscreenObject, selectAreaOffscreenObject,
+										selectAreaRect, blockRects, rIdx, gIdx, bIdx, currentParams.skipTransparent);
+									PixelSortLog("[PixelSort] Source cached: %dx%d sel=%d\n", fullW, fullH, source.select.empty() ? 0 : 1);
 								}
-								if (hasSelection)
+								else if (source.skipTransparent != currentParams.skipTransparent)
 								{
-									TriglavPlugInPtr selAddr; TriglavPlugInInt selRB, selPB;
-									(*pOffscreenService).getBlockSelectAreaProc(&selAddr, &selRB, &selPB, &tmpR, selectAreaOffscreenObject, &bpos);
-									if (selAddr != NULL)
-									{
-										fullSelect.resize(fullW * fullH, 0);
-										int bw = br.right - br.left, bh = br.bottom - br.top;
-										for (int y = 0; y < bh; ++y)
-										{
-											BYTE* sr = static_cast<BYTE*>(selAddr) + y * selRB;
-											int fy = (br.top - selectAreaRect.top) + y;
-											for (int x = 0; x < bw; ++x)
-											{
-												int fx = (br.left - selectAreaRect.left) + x;
-												fullSelect[fy * fullW + fx] = sr[x * selPB];
-											}
-										}
-									}
+									// Only the mask changes, but every stage reads it
+									GatherSourceMask(source, pOffscreenService, sourceOffscreenObject, selectAreaOffscreenObject,
+										selectAreaRect, blockRects, currentParams.skipTransparent);
+									stages.Invalidate();
+									proxyStages.Invalidate();
+									proxySource.valid = false;
+									PixelSortLog("[PixelSort] Source mask: sel=%d\n", source.select.empty() ? 0 : 1);
 								}
-							}
+								if (maskChanged)
+								{
+									RestoreSource(dest, source);
+									PixelSortLog("[PixelSort] Mask changed: source restored\n");
+								}
+								passStats.gather = gatherClock.Lap();
 
-							// Determine sort buffer and dimensions
-							bool useAngle = (currentParams.angle != 0 && currentParams.direction == kSortDirectionHorizontal);
-							BYTE* sortBuf = fullImage.data();
-							int sortW = fullW, sortH = fullH;
-							std::vector<BYTE> rotImage;
-							double cosA = 1.0, sinA = 0.0;
-							double cx = 0, cy = 0, rcx = 0, rcy = 0;
+								// Params already rendered in this session: the result is
+								// written as it was, with no proxy and no render
+								RenderCache& renders = workspace.renders;
+								const std::vector<BYTE>* cached = renders.Find(currentParams);
+								if (cached != NULL)
+								{
+									RenderStageClock writeClock;
+									target.SetProgressTotal(1);
+									ScatterRect(dest, cached->data(), fullW, 0, 0, fullW, fullH);
+									target.SetProgressDone(1);
+									passStats.write = writeClock.Lap();
+									LogRenderStats("cached", fullW, fullH, passStats);
+								}
 
-							if (useAngle)
-							{
-								double rad = currentParams.angle * M_PI / 180.0;
-								cosA = cos(rad); sinA = sin(rad);
-								sortW = (int)ceil(fabs(fullW * cosA) + fabs(fullH * sinA));
-								sortH = (int)ceil(fabs(fullW * sinA) + fabs(fullH * cosA));
-								if (sortW < 1) sortW = 1;
-								if (sortH < 1) sortH = 1;
-
-								rotImage.resize(sortW * sortH * 3, 0);
-								cx = (fullW - 1) / 2.0; cy = (fullH - 1) / 2.0;
-								rcx = (sortW - 1) / 2.0; rcy = (sortH - 1) / 2.0;
-
-								for (int ry = 0; ry < sortH; ++ry)
+								int proxyFactor = (cached != NULL) ? 1 : ProxyFactorFor(fullW, fullH);
+								if (proxyFactor > 1)
 								{
-									for (int rx = 0; rx < sortW; ++rx)
+									if (!proxySource.valid)
 									{
-										double dx = rx - rcx, dy = ry - rcy;
-										int sx = (int)(dx * cosA - dy * sinA + cx + 0.5);
-										int sy = (int)(dx * sinA + dy * cosA + cy + 0.5);
-										if (sx >= 0 && sx < fullW && sy >= 0 && sy < fullH)
+										DownsampleBox(source.image.data(), fullW, fullH, 3, proxyFactor,
+											proxySource.image, proxySource.width, proxySource.height);
+										if (!source.select.empty())
 										{
-											int si = (sy * fullW + sx) * 3;
-											int di = (ry * sortW + rx) * 3;
-											rotImage[di]     = fullImage[si];
-											rotImage[di + 1] = fullImage[si + 1];
-											rotImage[di + 2] = fullImage[si + 2];
+											DownsampleBox(source.select.data(), fullW, fullH, 1, proxyFactor,
+												proxySource.select, proxySource.width, proxySource.height);
 										}
+										proxySource.valid = true;
+										PixelSortLog("[PixelSort] Proxy: %dx%d (1/%d)\n", proxySource.width, proxySource.height, proxyFactor);
 									}
-								}
-								sortBuf = rotImage.data();
-							}
 
-							// Save original for selection blending
-							if (hasSelection && !fullSelect.empty())
-								origImage = fullImage;
+									RenderContext proxyCtx = renderCtx;
+									proxyCtx.pushBands = false;
+									status = RenderImage(proxyCtx, proxySource, proxyStages, ScaleParamsForProxy(currentParams, proxyFactor));
 
-							// Sort rows or columns on the sort buffer
-							if (currentParams.direction == kSortDirectionHorizontal)
-							{
-								for (int y = 0; y < sortH; ++y)
-								{
-									RowAccessor row;
-									row.imageBase = sortBuf + y * sortW * 3;
-									row.imagePixelBytes = 3;
-									row.imageRowBytes = sortW * 3;
-									row.rIdx = 0; row.gIdx = 1; row.bIdx = 2;
-									row.length = sortW;
-									row.vertical = false;
-
-									const BYTE* selRow = NULL;
-									int selStride = 0;
-									if (!useAngle && !fullSelect.empty())
+									if (status != kRenderStatusRestart)
 									{
-										selRow = fullSelect.data() + y * fullW;
-										selStride = 1;
+										RenderStageClock writeClock;
+										proxyUpsampled.resize(source.image.size());
+										UpsampleNearestRGB(proxyStages.fullImage.data(), proxySource.width, proxyFactor,
+											source.image.data(), source.select.empty() ? NULL : source.select.data(),
+											proxyUpsampled.data(), fullW, fullH);
+										ScatterRect(dest, proxyUpsampled.data(), fullW, 0, 0, fullW, fullH);
+										passStats.write += writeClock.Lap();
 									}
-
-									SortLine(row, currentParams, selRow, selStride, y, rng,
-										spansWork, brightnessWork, pixelsWork, includedIndices);
-								}
-							}
-							else // VERTICAL
-							{
-								for (int x = 0; x < sortW; ++x)
-								{
-									RowAccessor col;
-									col.imageBase = sortBuf + x * 3;
-									col.imagePixelBytes = 3;
-									col.imageRowBytes = sortW * 3;
-									col.rIdx = 0; col.gIdx = 1; col.bIdx = 2;
-									col.length = sortH;
-									col.vertical = true;
-
-									const BYTE* selCol = NULL;
-									int selStride = 0;
-									if (!fullSelect.empty())
+									LogRenderStats("proxy", proxySource.width, proxySource.height, passStats);
+									passStats = MakeRenderStats();
+									passStats.restarts = sessionRestarts;
+									if (status == kRenderStatusDone)
 									{
-										selCol = fullSelect.data() + x;
-										selStride = fullW;
+										TriglavPlugInInt processResult;
+										TriglavPlugInFilterRunProcess(pRecordSuite, &processResult, (*pluginServer).hostObject, kTriglavPlugInFilterRunProcessStateContinue);
+										if (processResult == kTriglavPlugInFilterRunProcessResultRestart)
+											status = kRenderStatusRestart;
+										else if (processResult == kTriglavPlugInFilterRunProcessResultExit)
+											status = kRenderStatusExit;
 									}
-
-									SortLine(col, currentParams, selCol, selStride, x, rng,
-										spansWork, brightnessWork, pixelsWork, includedIndices);
 								}
-							}
 
-							// Unrotate if needed
-							if (useAngle)
-							{
-								std::fill(fullImage.begin(), fullImage.end(), (BYTE)0);
-								for (int fy = 0; fy < fullH; ++fy)
+								// Full resolution. Once the host has asked to exit the
+								// render can no longer be dropped: it is the final result.
+								if (cached == NULL && status == kRenderStatusDone)
 								{
-									for (int fx = 0; fx < fullW; ++fx)
-									{
-										double dx = fx - cx, dy = fy - cy;
-										int rx = (int)(dx * cosA + dy * sinA + rcx + 0.5);
-										int ry = (int)(-dx * sinA + dy * cosA + rcy + 0.5);
-										if (rx >= 0 && rx < sortW && ry >= 0 && ry < sortH)
-										{
-											int si = (ry * sortW + rx) * 3;
-											int di = (fy * fullW + fx) * 3;
-											fullImage[di]     = rotImage[si];
-											fullImage[di + 1] = rotImage[si + 1];
-											fullImage[di + 2] = rotImage[si + 2];
-										}
-									}
+									status = RenderImage(renderCtx, source, stages, currentParams);
+									LogRenderStats("full", fullW, fullH, passStats);
+									if (status != kRenderStatusRestart)
+										CacheRenderResult(renders, currentParams, stages, dest);
 								}
-							}
-
-							// Apply selection blending (for angle mode, blend after unrotate)
-							if (useAngle && hasSelection && !fullSelect.empty())
-							{
-								for (int i = 0; i < fullW * fullH; ++i)
+								else if (cached == NULL && status == kRenderStatusExit)
 								{
-									BYTE sel = fullSelect[i];
-									if (sel == 0)
-									{
-										fullImage[i * 3 + 0] = origImage[i * 3 + 0];
-										fullImage[i * 3 + 1] = origImage[i * 3 + 1];
-										fullImage[i * 3 + 2] = origImage[i * 3 + 2];
-									}
-									else if (sel < 255)
-									{
-										for (int c = 0; c < 3; ++c)
-										{
-											int idx = i * 3 + c;
-											fullImage[idx] = static_cast<BYTE>(
-												((fullImage[idx] - origImage[idx]) * sel / 255) + origImage[idx]);
-										}
-									}
+									RenderContext finalCtx = renderCtx;
+									finalCtx.cancellable = false;
+									RenderImage(finalCtx, source, stages, currentParams);
+									LogRenderStats("full", fullW, fullH, passStats);
 								}
 							}
+							renderCtx.stats = NULL;
 
-							// Write back to destination blocks
-							for (TriglavPlugInInt bi = 0; bi < blockRectCount; ++bi)
+							if (status == kRenderStatusExit) break;
+							if (status == kRenderStatusRestart)
 							{
-								TriglavPlugInRect br = blockRects[bi];
-								TriglavPlugInPoint bpos; bpos.x = br.left; bpos.y = br.top;
-								TriglavPlugInRect tmpR;
-								TriglavPlugInPtr imgAddr; TriglavPlugInInt imgRB, imgPB;
-								(*pOffscreenService).getBlockImageProc(&imgAddr, &imgRB, &imgPB, &tmpR, destinationOffscreenObject, &bpos);
-								if (imgAddr != NULL)
-								{
-									int bw = br.right - br.left, bh = br.bottom - br.top;
-									for (int y = 0; y < bh; ++y)
-									{
-										BYTE* dr = static_cast<BYTE*>(imgAddr) + y * imgRB;
-										int fy = (br.top - selectAreaRect.top) + y;
-										for (int x = 0; x < bw; ++x)
-										{
-											int fx = (br.left - selectAreaRect.left) + x;
-											int idx = (fy * fullW + fx) * 3;
-											BYTE* dp = dr + x * imgPB;
-											dp[rIdx] = fullImage[idx + 0];
-											dp[gIdx] = fullImage[idx + 1];
-											dp[bIdx] = fullImage[idx + 2];
-										}
-									}
-								}
-								TriglavPlugInFilterRunUpdateDestinationOffscreenRect(pRecordSuite, (*pluginServer).hostObject, &br);
+								++sessionRestarts;
+								restart = true;
+								continue; // params changed mid-render; start over
 							}
 						}
-						blockIndex = blockRectCount;
 					}
 				}
 
-				if (blockIndex < blockRectCount)
-				{
-					// Fallback: should not reach here with full-image processing
-					++blockIndex;
-				}
-
 				TriglavPlugInInt processResult;
-				if (blockIndex < blockRectCount)
-				{
-					TriglavPlugInFilterRunProcess(pRecordSuite, &processResult, (*pluginServer).hostObject, kTriglavPlugInFilterRunProcessStateContinue);
-				}
-				else
-				{
-					TriglavPlugInFilterRunSetProgressDone(pRecordSuite, (*pluginServer).hostObject, blockIndex);
-					TriglavPlugInFilterRunProcess(pRecordSuite, &processResult, (*pluginServer).hostObject, kTriglavPlugInFilterRunProcessStateEnd);
-				}
+				TriglavPlugInFilterRunSetProgressDone(pRecordSuite, (*pluginServer).hostObject, target.progressDone);
+				TriglavPlugInFilterRunProcess(pRecordSuite, &processResult, (*pluginServer).hostObject, kTriglavPlugInFilterRunProcessStateEnd);
 
 				if (processResult == kTriglavPlugInFilterRunProcessResultRestart)
 				{
+					++sessionRestarts;
 					restart = true;
 				}
 				else if (processResult == kTriglavPlugInFilterRunProcessResultExit)
@@ -947,6 +2228,12 @@ void TRIGLAV_PLUGIN_API TriglavPluginCall(
 					break;
 				}
 			}
+			PixelSortLog("[PixelSort] Session: %d restarts, render cache %d hits / %d misses\n", sessionRestarts,
+				workspace.renders.GetHits(), workspace.renders.GetMisses());
+			workspace.renders.Clear(); // the next run has a new source
+			bool bitmapAvailable = pBitmapService != NULL && !pInfo->io.bitmapRejected;
+			pInfo->io.gather.Log("gather", bitmapAvailable);
+			pInfo->io.scatter.Log("scatter", bitmapAvailable);
 			*result = kTriglavPlugInCallResultSuccess;
 		}
 	}
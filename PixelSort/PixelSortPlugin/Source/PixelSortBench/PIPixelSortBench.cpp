@@ -0,0 +1,405 @@
+//! @file   PIPixelSortBench.cpp
+//! @brief  Standalone benchmark of the render pipeline over every key, mode, layout and selection
+//!
+//! Usage: PixelSortBench [--size 4k|8k|16k|WxH]... [--image file.ppm]... [--threads N]
+//!                       [--repeat N] [--tile N] [--gpu] [--csv] [--verbose]
+//!                       [--tuning file] [--calibrate file]
+//!
+//! Every image is sorted with each SortKey x IntervalMode x layout
+//! (horizontal, vertical, 30 degree angle) x selection (none, soft ellipse),
+//! every stage rebuilt each time. One line per render gives the wall time,
+//! megapixels per second and the time of each pipeline stage. --gpu sorts
+//! large passes on the GPU sort device, as the plug-in does. --tuning
+//! renders with a tuning profile's engine choices; --calibrate measures
+//! this machine, writes its profile and exits. The plug-in reads the same
+//! format from PixelSort.tuning beside its DLL or in %LOCALAPPDATA%\PixelSort.
+
+#include "PixelSortCore/PIRenderPipeline.h"
+#include "PixelSortCore/PIRenderTuning.h"
+#include "PixelSortCore/PISyntheticImage.h"
+#include "PlugInCommon/PIEdgeScan.h"
+#include "PlugInCommon/PIKeySIMD.h"
+#include "PlugInCommon/PIPixelCopy.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Combinations
+// ---------------------------------------------------------------------------
+
+static const char* const kKeyNames[] =
+{
+	"brightness", "hue", "saturation", "intensity", "minimum", "red", "green", "blue"
+};
+static const int kKeyCount = 8;
+
+static const char* const kModeNames[] =
+{
+	"threshold", "random", "edges", "waves", "none"
+};
+static const int kModeCount = 5;
+
+struct BenchLayout
+{
+	const char*   name;
+	SortDirection direction;
+	int           angle;
+};
+
+static const BenchLayout kLayouts[] =
+{
+	{ "horiz", kSortDirectionHorizontal, 0 },
+	{ "vert",  kSortDirectionVertical,   0 },
+	{ "ang30", kSortDirectionHorizontal, 30 }
+};
+static const int kLayoutCount = 3;
+
+// ---------------------------------------------------------------------------
+// Images
+// ---------------------------------------------------------------------------
+
+struct BenchImage
+{
+	std::string name;
+	SourceImage plain;    // no selection
+	SourceImage selected; // same pixels with a soft elliptical selection
+};
+
+// Skips whitespace and '#' comments between PPM header fields
+static bool ReadPpmInt(FILE* f, int& value)
+{
+	int c = fgetc(f);
+	while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+	{
+		if (c == '#')
+		{
+			while (c != '\n' && c != EOF)
+				c = fgetc(f);
+		}
+		c = fgetc(f);
+	}
+	if (c < '0' || c > '9') return false;
+	value = 0;
+	while (c >= '0' && c <= '9')
+	{
+		value = value * 10 + (c - '0');
+		c = fgetc(f);
+	}
+	return true; // the single whitespace after the field is consumed
+}
+
+// Binary PPM (P6) with 8-bit samples
+static bool LoadPpm(const char* path, int& w, int& h, std::vector<BYTE>& image)
+{
+	FILE* f = NULL;
+	if (fopen_s(&f, path, "rb") != 0 || f == NULL) return false;
+	int maxval = 0;
+	bool ok = fgetc(f) == 'P' && fgetc(f) == '6' &&
+		ReadPpmInt(f, w) && ReadPpmInt(f, h) && ReadPpmInt(f, maxval) &&
+		w > 0 && h > 0 && maxval == 255;
+	if (ok)
+	{
+		image.resize(static_cast<size_t>(w) * h * 3);
+		ok = fread(image.data(), 1, image.size(), f) == image.size();
+	}
+	fclose(f);
+	return ok;
+}
+
+static void FillBenchImage(BenchImage& img, const std::string& name, int w, int h)
+{
+	img.name = name;
+	img.plain.width = img.selected.width = w;
+	img.plain.height = img.selected.height = h;
+	img.selected.image = img.plain.image;
+	MakeEllipseSelection(w, h, img.selected.select);
+}
+
+// "4k", "8k", "16k" or "WxH"
+static bool ParseSize(const char* s, int& w, int& h)
+{
+	if (strcmp(s, "4k") == 0)  { w = 3840;  h = 2160; return true; }
+	if (strcmp(s, "8k") == 0)  { w = 7680;  h = 4320; return true; }
+	if (strcmp(s, "16k") == 0) { w = 15360; h = 8640; return true; }
+	return sscanf_s(s, "%dx%d", &w, &h) == 2 && w > 0 && h > 0;
+}
+
+// ---------------------------------------------------------------------------
+// Render target
+// ---------------------------------------------------------------------------
+
+// A destination buffer laid out like the host's (4 bytes per pixel, B G R A)
+// and cut into tiles of `tile` pixels: rows wider than a tile are staged
+// and copied out, like rows crossing several canvas blocks.
+struct BenchTarget : PixelSortRenderTarget
+{
+	std::vector<BYTE> pixels;
+	int               width;
+	int               height;
+	int               tile;
+	PixelLayout       layout;
+
+	BenchTarget(int w, int h, int tileSize)
+		: pixels(static_cast<size_t>(w) * h * 4, 0)
+		, width(w)
+		, height(h)
+		, tile(tileSize)
+		, layout(MakePixelLayout(4, 2, 1, 0))
+	{
+	}
+
+	BYTE* Row(int y)
+	{
+		return pixels.data() + static_cast<size_t>(y) * width * 4;
+	}
+
+	virtual void BeginRows()
+	{
+	}
+
+	virtual bool BeginRow(int, int y, const BYTE* src, bool staged, LineScratch& scratch, RowAccessor& row)
+	{
+		row.length = width;
+		if (!staged && width <= tile)
+		{
+			row.imageBase = Row(y);
+			row.imagePixelBytes = 4;
+			row.rIdx = layout.rIdx; row.gIdx = layout.gIdx; row.bIdx = layout.bIdx;
+			GetPixelCopyKernel().write(src, layout, row.imageBase, width);
+			return false;
+		}
+		scratch.lineStaging.assign(src, src + static_cast<size_t>(width) * 3);
+		row.imageBase = scratch.lineStaging.data();
+		row.imagePixelBytes = 3;
+		row.rIdx = 0; row.gIdx = 1; row.bIdx = 2;
+		return true;
+	}
+
+	virtual void FlushStagedRow(int, int y, const LineScratch& scratch)
+	{
+		GetPixelCopyKernel().write(scratch.lineStaging.data(), layout, Row(y), width);
+	}
+
+	virtual void RowsUpdated(int, int)
+	{
+	}
+
+	virtual void WriteRect(const BYTE* image, int w, int x0, int y0, int x1, int y1)
+	{
+		WritePixelsRGBFunc write = GetPixelCopyKernel().write;
+		for (int y = y0; y < y1; ++y)
+			write(image + (static_cast<size_t>(y) * w + x0) * 3, layout, Row(y) + static_cast<size_t>(x0) * 4, x1 - x0);
+	}
+
+	virtual void SetProgressTotal(int)
+	{
+	}
+
+	virtual void SetProgressDone(int)
+	{
+	}
+
+	virtual RenderStatus Poll()
+	{
+		return kRenderStatusDone;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+static void IgnoreLog(const char*)
+{
+}
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: PixelSortBench [--size 4k|8k|16k|WxH]... [--image file.ppm]...\n"
+		"                      [--threads N] [--repeat N] [--tile N] [--gpu] [--csv] [--verbose]\n"
+		"                      [--tuning file] [--calibrate file]\n");
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<BenchImage> images;
+	int threads = 0;
+	int repeat = 1;
+	int tile = 256;
+	bool csv = false;
+	bool verbose = false;
+	bool gpu = false;
+	const char* tuningPath = NULL;
+	const char* calibratePath = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--csv") == 0) { csv = true; continue; }
+		if (strcmp(arg, "--verbose") == 0) { verbose = true; continue; }
+		if (strcmp(arg, "--gpu") == 0) { gpu = true; continue; }
+		if (value == NULL) { PrintUsage(); return 1; }
+		++i;
+		if (strcmp(arg, "--size") == 0)
+		{
+			int w, h;
+			if (!ParseSize(value, w, h)) { fprintf(stderr, "bad size: %s\n", value); return 1; }
+			images.push_back(BenchImage());
+			MakeSyntheticImage(w, h, images.back().plain.image);
+			FillBenchImage(images.back(), std::string("synthetic-") + value, w, h);
+		}
+		else if (strcmp(arg, "--image") == 0)
+		{
+			int w, h;
+			images.push_back(BenchImage());
+			if (!LoadPpm(value, w, h, images.back().plain.image)) { fprintf(stderr, "cannot read P6 PPM: %s\n", value); return 1; }
+			FillBenchImage(images.back(), value, w, h);
+		}
+		else if (strcmp(arg, "--threads") == 0) threads = atoi(value);
+		else if (strcmp(arg, "--repeat") == 0)  repeat = (std::max)(1, atoi(value));
+		else if (strcmp(arg, "--tile") == 0)    tile = (std::max)(1, atoi(value));
+		else if (strcmp(arg, "--tuning") == 0)    tuningPath = value;
+		else if (strcmp(arg, "--calibrate") == 0) calibratePath = value;
+		else { PrintUsage(); return 1; }
+	}
+	if (images.empty())
+	{
+		images.push_back(BenchImage());
+		MakeSyntheticImage(3840, 2160, images.back().plain.image);
+		FillBenchImage(images.back(), "synthetic-4k", 3840, 2160);
+	}
+	if (!verbose)
+		PixelSortSetLogSink(IgnoreLog);
+
+	// Freed on every return
+	std::unique_ptr<PixelSortDevice> deviceOwner(gpu ? CreatePixelSortDevice() : NULL);
+	PixelSortDevice* device = deviceOwner.get();
+	if (gpu && device == NULL)
+	{
+		fprintf(stderr, "no GPU sort device\n");
+		return 1;
+	}
+
+	if (calibratePath != NULL)
+	{
+		RenderTuning calibrated = CalibrateRenderTuning(device);
+		LogRenderTuning("calibrated", calibrated);
+		if (!SaveRenderTuning(calibratePath, calibrated))
+		{
+			fprintf(stderr, "cannot write %s\n", calibratePath);
+			return 1;
+		}
+		printf("wrote %s\n", calibratePath);
+		return 0;
+	}
+
+	RenderTuning tuning = MakeDefaultTuning();
+	if (tuningPath != NULL)
+	{
+		if (!LoadRenderTuning(tuningPath, tuning))
+		{
+			fprintf(stderr, "cannot read tuning profile: %s\n", tuningPath);
+			return 1;
+		}
+		if (threads == 0)
+			threads = tuning.threadCount;
+	}
+
+	PixelSortThreadPool pool(threads);
+	std::vector<LineScratch> scratches(pool.GetThreadCount());
+	StageCache stages;
+	fprintf(stderr, "threads=%d key=%s copy=%s edge=%s gpu=%s tuning=%s\n", pool.GetThreadCount(),
+		GetKeyKernel().name, GetPixelCopyKernel().name, GetEdgeKernel().name,
+		device != NULL ? device->GetName() : "off", tuningPath != NULL ? tuningPath : "defaults");
+
+	if (csv)
+		printf("image,width,height,key,mode,layout,selection,ms,mps,layout_ms,keys_ms,spans_ms,sort_ms,blend_ms,write_ms,spans,avg_span\n");
+
+	for (size_t ii = 0; ii < images.size(); ++ii)
+	{
+		const BenchImage& img = images[ii];
+		int w = img.plain.width, h = img.plain.height;
+		double mp = static_cast<double>(w) * h / 1.0e6;
+		BenchTarget target(w, h, tile);
+		if (!csv)
+			printf("== %s %dx%d (%.1f MP)\n", img.name.c_str(), w, h, mp);
+
+		double totalSeconds = 0.0;
+		int renders = 0;
+		for (int sel = 0; sel < 2; ++sel)
+		for (int li = 0; li < kLayoutCount; ++li)
+		for (int mode = 0; mode < kModeCount; ++mode)
+		for (int key = 0; key < kKeyCount; ++key)
+		{
+			PixelSortParams params = MakeDefaultParams();
+			params.sortKey = static_cast<SortKey>(key);
+			params.intervalMode = static_cast<IntervalMode>(mode);
+			params.direction = kLayouts[li].direction;
+			params.angle = kLayouts[li].angle;
+			ClampParams(params);
+
+			RenderStats stats = MakeRenderStats();
+			RenderContext ctx;
+			ctx.pool = &pool;
+			ctx.scratches = &scratches;
+			ctx.device = device;
+			ctx.tuning = &tuning;
+			ctx.target = &target;
+			ctx.pushBands = true;
+			ctx.cancellable = false;
+			ctx.stats = &stats;
+
+			// Best of `repeat` cold renders (every stage rebuilt)
+			double best = 0.0;
+			RenderStats bestStats = stats;
+			for (int r = 0; r < repeat; ++r)
+			{
+				stats = MakeRenderStats();
+				stages.Invalidate();
+				double start = PixelSortSeconds();
+				RenderImage(ctx, sel ? img.selected : img.plain, stages, params);
+				double seconds = PixelSortSeconds() - start;
+				if (r == 0 || seconds < best)
+				{
+					best = seconds;
+					bestStats = stats;
+				}
+			}
+			totalSeconds += best;
+			++renders;
+
+			const char* selName = sel ? "ellipse" : "none";
+			const RenderCounts& counts = bestStats.counts;
+			double avgSpan = (counts.spans > 0) ? static_cast<double>(counts.pixels) / static_cast<double>(counts.spans) : 0.0;
+			if (csv)
+			{
+				printf("%s,%d,%d,%s,%s,%s,%s,%.2f,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%lld,%.1f\n",
+					img.name.c_str(), w, h, kKeyNames[key], kModeNames[mode], kLayouts[li].name, selName,
+					best * 1000.0, mp / best, bestStats.layout * 1000.0, bestStats.keys * 1000.0,
+					bestStats.spans * 1000.0, bestStats.sort * 1000.0, bestStats.blend * 1000.0,
+					bestStats.write * 1000.0, counts.spans, avgSpan);
+			}
+			else
+			{
+				printf("%-10s %-9s %-5s %-7s %9.1f ms %8.1f MP/s | layout %7.1f keys %7.1f spans %7.1f sort %7.1f blend %7.1f write %7.1f | %lld spans, avg %.1f px\n",
+					kKeyNames[key], kModeNames[mode], kLayouts[li].name, selName,
+					best * 1000.0, mp / best, bestStats.layout * 1000.0, bestStats.keys * 1000.0,
+					bestStats.spans * 1000.0, bestStats.sort * 1000.0, bestStats.blend * 1000.0,
+					bestStats.write * 1000.0, counts.spans, avgSpan);
+			}
+			fflush(stdout);
+		}
+		if (!csv && renders > 0)
+		{
+			printf("== %s: %d renders, %.1f ms total, %.1f MP/s average\n\n",
+				img.name.c_str(), renders, totalSeconds * 1000.0, mp * renders / totalSeconds);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,552 @@
+//! @file   PIGpuSort.cpp
+//! @brief  Optional GPU sort backend (Direct3D 11 compute): stable sort of 32-bit keys
+#include "PixelSortCore/PIGpuSort.h"
+#include "PlugInCommon/PIPixelSort.h"
+
+#if defined(_WIN32) && PIXELSORT_GPU
+
+#include <windows.h>
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <dxgi.h>
+#include <cstring>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Sort shaders
+// ---------------------------------------------------------------------------
+
+// LSD radix sort, 4 bits a pass. Each pass counts the digits of every tile
+// of 1024 keys, scans the counts digit-major (all tiles' 0s, then all 1s,
+// ...), and scatters every tile's keys to their digit's offset. A thread owns
+// 4 consecutive keys and tiles keep key order within a digit, so the sort is
+// stable. The first pass takes the key indices as values.
+static const char kSortShaderSource[] = R"HLSL(
+cbuffer SortPass : register(b0)
+{
+	uint g_count;     // keys in the batch
+	uint g_shift;     // digit of this pass
+	uint g_tileCount; // tiles of TILE keys
+	uint g_firstPass; // values are the key indices
+};
+
+#define GROUP_SIZE 256
+#define ITEMS      4
+#define TILE       (GROUP_SIZE * ITEMS)
+#define RADIX      16
+#define LANES      (RADIX / 2)
+
+StructuredBuffer<uint>   g_keysIn    : register(t0);
+StructuredBuffer<uint>   g_valuesIn  : register(t1);
+StructuredBuffer<uint>   g_offsets   : register(t2); // scanned counts
+StructuredBuffer<uint>   g_blockBase : register(t3); // scanned sums of TILE counts
+RWStructuredBuffer<uint> g_keysOut   : register(u0);
+RWStructuredBuffer<uint> g_valuesOut : register(u1);
+RWStructuredBuffer<uint> g_counts    : register(u2);
+RWStructuredBuffer<uint> g_blockSums : register(u3);
+
+groupshared uint s_digitCounts[RADIX];
+groupshared uint s_scan[2][GROUP_SIZE];
+groupshared uint s_laneScan[2][GROUP_SIZE * LANES];
+
+// Inclusive prefix sum of `value` over the group
+uint GroupInclusiveScan(uint value, uint gi)
+{
+	GroupMemoryBarrierWithGroupSync();
+	s_scan[0][gi] = value;
+	GroupMemoryBarrierWithGroupSync();
+	uint src = 0;
+	[unroll]
+	for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1)
+	{
+		uint v = s_scan[src][gi];
+		if (gi >= offset)
+			v += s_scan[src][gi - offset];
+		s_scan[src ^ 1][gi] = v;
+		src ^= 1;
+		GroupMemoryBarrierWithGroupSync();
+	}
+	return s_scan[src][gi];
+}
+
+// Exclusive scan of `length` entries of `data`, TILE a group; the group's
+// total goes to blockSums[group] when `writeTotal`
+void ScanTile(RWStructuredBuffer<uint> data, uint length, uint group, uint gi, bool writeTotal)
+{
+	uint base = group * TILE + gi * ITEMS;
+	uint v[ITEMS];
+	uint sum = 0;
+	[unroll]
+	for (uint k = 0; k < ITEMS; ++k)
+	{
+		v[k] = (base + k < length) ? data[base + k] : 0;
+		sum += v[k];
+	}
+	uint inclusive = GroupInclusiveScan(sum, gi);
+	uint running = inclusive - sum;
+	[unroll]
+	for (uint k2 = 0; k2 < ITEMS; ++k2)
+	{
+		if (base + k2 < length)
+			data[base + k2] = running;
+		running += v[k2];
+	}
+	if (writeTotal && gi == GROUP_SIZE - 1)
+		g_blockSums[group] = inclusive;
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void CountDigits(uint3 gid : SV_GroupID, uint gi : SV_GroupIndex)
+{
+	if (gi < RADIX)
+		s_digitCounts[gi] = 0;
+	GroupMemoryBarrierWithGroupSync();
+	uint base = gid.x * TILE;
+	[unroll]
+	for (uint k = 0; k < ITEMS; ++k)
+	{
+		uint i = base + k * GROUP_SIZE + gi;
+		if (i < g_count)
+		{
+			uint digit = (g_keysIn[i] >> g_shift) & (RADIX - 1);
+			InterlockedAdd(s_digitCounts[digit], 1);
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+	if (gi < RADIX)
+		g_counts[gi * g_tileCount + gid.x] = s_digitCounts[gi];
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void ScanCounts(uint3 gid : SV_GroupID, uint gi : SV_GroupIndex)
+{
+	ScanTile(g_counts, RADIX * g_tileCount, gid.x, gi, true);
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void ScanBlockSums(uint3 gid : SV_GroupID, uint gi : SV_GroupIndex)
+{
+	ScanTile(g_blockSums, (RADIX * g_tileCount + TILE - 1) / TILE, 0, gi, false);
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void ScatterKeys(uint3 gid : SV_GroupID, uint gi : SV_GroupIndex)
+{
+	// Rank of each of the thread's keys among its own keys of the same
+	// digit; per-digit counts packed two 16-bit lanes to a uint
+	uint base = gid.x * TILE + gi * ITEMS;
+	uint keys[ITEMS];
+	uint values[ITEMS];
+	uint digits[ITEMS];
+	uint ranks[ITEMS];
+	uint packed[LANES];
+	[unroll]
+	for (uint l = 0; l < LANES; ++l)
+		packed[l] = 0;
+	[unroll]
+	for (uint k = 0; k < ITEMS; ++k)
+	{
+		uint i = base + k;
+		digits[k] = RADIX;
+		ranks[k] = 0;
+		keys[k] = 0;
+		values[k] = 0;
+		if (i < g_count)
+		{
+			keys[k] = g_keysIn[i];
+			values[k] = g_firstPass ? i : g_valuesIn[i];
+			uint digit = (keys[k] >> g_shift) & (RADIX - 1);
+			uint laneShift = (digit & 1) * 16;
+			digits[k] = digit;
+			ranks[k] = (packed[digit >> 1] >> laneShift) & 0xFFFF;
+			packed[digit >> 1] += 1u << laneShift;
+		}
+	}
+
+	// Keys of each digit in the tile's earlier threads
+	GroupMemoryBarrierWithGroupSync();
+	[unroll]
+	for (uint l2 = 0; l2 < LANES; ++l2)
+		s_laneScan[0][gi * LANES + l2] = packed[l2];
+	GroupMemoryBarrierWithGroupSync();
+	uint src = 0;
+	[unroll]
+	for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1)
+	{
+		[unroll]
+		for (uint l3 = 0; l3 < LANES; ++l3)
+		{
+			uint v = s_laneScan[src][gi * LANES + l3];
+			if (gi >= offset)
+				v += s_laneScan[src][(gi - offset) * LANES + l3];
+			s_laneScan[src ^ 1][gi * LANES + l3] = v;
+		}
+		src ^= 1;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	[unroll]
+	for (uint k2 = 0; k2 < ITEMS; ++k2)
+	{
+		uint digit = digits[k2];
+		if (digit < RADIX)
+		{
+			uint laneShift = (digit & 1) * 16;
+			uint before = ((s_laneScan[src][gi * LANES + (digit >> 1)] - packed[digit >> 1]) >> laneShift) & 0xFFFF;
+			uint slot = digit * g_tileCount + gid.x;
+			uint pos = g_offsets[slot] + g_blockBase[slot / TILE] + before + ranks[k2];
+			g_keysOut[pos] = keys[k2];
+			g_valuesOut[pos] = values[k2];
+		}
+	}
+}
+)HLSL";
+
+static const int kSortTile = 1024;  // keys per tile (GROUP_SIZE * ITEMS)
+static const int kSortRadixBits = 4;
+static const int kSortRadix = 16;
+
+// The counts of a batch are scanned in one level of block sums, at most
+// kSortTile blocks of kSortTile counts
+static const int kSortMaxCount = kSortTile * (kSortTile * kSortTile / kSortRadix);
+
+// ---------------------------------------------------------------------------
+// Direct3D 11 device
+// ---------------------------------------------------------------------------
+
+template <class T>
+static void ReleaseCom(T*& p)
+{
+	if (p != NULL)
+	{
+		p->Release();
+		p = NULL;
+	}
+}
+
+// A structured buffer of uints with both views
+struct DeviceBuffer
+{
+	ID3D11Buffer*              buffer;
+	ID3D11ShaderResourceView*  srv;
+	ID3D11UnorderedAccessView* uav;
+
+	DeviceBuffer() : buffer(NULL), srv(NULL), uav(NULL) {}
+
+	bool Create(ID3D11Device* device, int count)
+	{
+		Release();
+		D3D11_BUFFER_DESC desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.ByteWidth = static_cast<UINT>(count * sizeof(UINT));
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = sizeof(UINT);
+		if (FAILED(device->CreateBuffer(&desc, NULL, &buffer))) return false;
+		if (FAILED(device->CreateShaderResourceView(buffer, NULL, &srv))) return false;
+		if (FAILED(device->CreateUnorderedAccessView(buffer, NULL, &uav))) return false;
+		return true;
+	}
+
+	void Release()
+	{
+		ReleaseCom(uav);
+		ReleaseCom(srv);
+		ReleaseCom(buffer);
+	}
+};
+
+// Mirrors cbuffer SortPass
+struct SortPassConstants
+{
+	UINT count;
+	UINT shift;
+	UINT tileCount;
+	UINT firstPass;
+};
+
+class D3D11SortDevice : public PixelSortDevice
+{
+public:
+	D3D11SortDevice()
+		: m_d3d11(NULL), m_compiler(NULL), m_device(NULL), m_context(NULL)
+		, m_countDigits(NULL), m_scanCounts(NULL), m_scanBlockSums(NULL), m_scatterKeys(NULL)
+		, m_constants(NULL), m_readback(NULL), m_capacity(0)
+	{
+		m_name[0] = '\0';
+	}
+
+	~D3D11SortDevice()
+	{
+		ReleaseBuffers();
+		ReleaseCom(m_constants);
+		ReleaseCom(m_scatterKeys);
+		ReleaseCom(m_scanBlockSums);
+		ReleaseCom(m_scanCounts);
+		ReleaseCom(m_countDigits);
+		ReleaseCom(m_context);
+		ReleaseCom(m_device);
+		if (m_compiler != NULL) FreeLibrary(m_compiler);
+		if (m_d3d11 != NULL) FreeLibrary(m_d3d11);
+	}
+
+	// Device, shaders and constant buffer. The DLLs are loaded here, so a
+	// system without them only loses the GPU backend.
+	bool Initialize()
+	{
+		m_d3d11 = LoadLibraryA("d3d11.dll");
+		m_compiler = LoadLibraryA("d3dcompiler_47.dll");
+		if (m_d3d11 == NULL || m_compiler == NULL) return false;
+		PFN_D3D11_CREATE_DEVICE createDevice = reinterpret_cast<PFN_D3D11_CREATE_DEVICE>(GetProcAddress(m_d3d11, "D3D11CreateDevice"));
+		pD3DCompile compile = reinterpret_cast<pD3DCompile>(GetProcAddress(m_compiler, "D3DCompile"));
+		if (createDevice == NULL || compile == NULL) return false;
+
+		const D3D_FEATURE_LEVEL level = D3D_FEATURE_LEVEL_11_0;
+		D3D_FEATURE_LEVEL created;
+		if (FAILED(createDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, 0, &level, 1, D3D11_SDK_VERSION,
+			&m_device, &created, &m_context)))
+			return false;
+		ReadAdapterName();
+
+		if (!CompileShader(compile, "CountDigits", m_countDigits) ||
+			!CompileShader(compile, "ScanCounts", m_scanCounts) ||
+			!CompileShader(compile, "ScanBlockSums", m_scanBlockSums) ||
+			!CompileShader(compile, "ScatterKeys", m_scatterKeys))
+			return false;
+
+		D3D11_BUFFER_DESC desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.ByteWidth = sizeof(SortPassConstants);
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		return SUCCEEDED(m_device->CreateBuffer(&desc, NULL, &m_constants));
+	}
+
+	virtual const char* GetName() const
+	{
+		return m_name;
+	}
+
+	virtual int GetMaxCount() const
+	{
+		return kSortMaxCount;
+	}
+
+	virtual bool SortKeys(const unsigned int* keys, int count, int keyBits, unsigned int* order)
+	{
+		if (count <= 0) return true;
+		if (count > kSortMaxCount || !Reserve(count)) return false;
+
+		D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(count * sizeof(UINT)), 1, 1 };
+		m_context->UpdateSubresource(m_keys[0].buffer, 0, &box, keys, 0, 0);
+
+		int tileCount = (count + kSortTile - 1) / kSortTile;
+		int scanGroups = (kSortRadix * tileCount + kSortTile - 1) / kSortTile;
+		int passes = (std::max)(1, (keyBits + kSortRadixBits - 1) / kSortRadixBits);
+		int src = 0;
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			SortPassConstants constants = { static_cast<UINT>(count), static_cast<UINT>(pass * kSortRadixBits),
+				static_cast<UINT>(tileCount), pass == 0 ? 1u : 0u };
+			m_context->UpdateSubresource(m_constants, 0, NULL, &constants, 0, 0);
+			m_context->CSSetConstantBuffers(0, 1, &m_constants);
+
+			ID3D11ShaderResourceView* countIn[1] = { m_keys[src].srv };
+			ID3D11UnorderedAccessView* countOut[4] = { NULL, NULL, m_counts.uav, NULL };
+			Dispatch(m_countDigits, countIn, 1, countOut, 4, tileCount);
+
+			ID3D11UnorderedAccessView* scanOut[4] = { NULL, NULL, m_counts.uav, m_blockSums.uav };
+			Dispatch(m_scanCounts, NULL, 0, scanOut, 4, scanGroups);
+			Dispatch(m_scanBlockSums, NULL, 0, scanOut, 4, 1);
+
+			ID3D11ShaderResourceView* scatterIn[4] = { m_keys[src].srv, m_values[src].srv, m_counts.srv, m_blockSums.srv };
+			ID3D11UnorderedAccessView* scatterOut[2] = { m_keys[src ^ 1].uav, m_values[src ^ 1].uav };
+			Dispatch(m_scatterKeys, scatterIn, 4, scatterOut, 2, tileCount);
+			src ^= 1;
+		}
+
+		D3D11_BOX readBox = { 0, 0, 0, static_cast<UINT>(count * sizeof(UINT)), 1, 1 };
+		m_context->CopySubresourceRegion(m_readback, 0, 0, 0, 0, m_values[src].buffer, 0, &readBox);
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(m_context->Map(m_readback, 0, D3D11_MAP_READ, 0, &mapped)))
+		{
+			PixelSortLog("[PixelSort] GPU sort failed (device removed: 0x%08lX)\n",
+				static_cast<unsigned long>(m_device->GetDeviceRemovedReason()));
+			return false;
+		}
+		memcpy(order, mapped.pData, static_cast<size_t>(count) * sizeof(UINT));
+		m_context->Unmap(m_readback, 0);
+		return true;
+	}
+
+private:
+	void ReadAdapterName()
+	{
+		strcpy_s(m_name, sizeof(m_name), "Direct3D 11");
+		IDXGIDevice* dxgiDevice = NULL;
+		IDXGIAdapter* adapter = NULL;
+		DXGI_ADAPTER_DESC desc;
+		if (SUCCEEDED(m_device->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice))) &&
+			SUCCEEDED(dxgiDevice->GetAdapter(&adapter)) && SUCCEEDED(adapter->GetDesc(&desc)))
+		{
+			WideCharToMultiByte(CP_UTF8, 0, desc.Description, -1, m_name, sizeof(m_name), NULL, NULL);
+		}
+		ReleaseCom(adapter);
+		ReleaseCom(dxgiDevice);
+	}
+
+	bool CompileShader(pD3DCompile compile, const char* entry, ID3D11ComputeShader*& shader)
+	{
+		ID3DBlob* code = NULL;
+		ID3DBlob* errors = NULL;
+		HRESULT hr = compile(kSortShaderSource, sizeof(kSortShaderSource) - 1, "PixelSortGpu", NULL, NULL,
+			entry, "cs_5_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &code, &errors);
+		if (FAILED(hr))
+		{
+			PixelSortLog("[PixelSort] GPU shader %s: %s\n", entry,
+				errors != NULL ? static_cast<const char*>(errors->GetBufferPointer()) : "compile failed");
+			ReleaseCom(errors);
+			return false;
+		}
+		ReleaseCom(errors);
+		hr = m_device->CreateComputeShader(code->GetBufferPointer(), code->GetBufferSize(), NULL, &shader);
+		ReleaseCom(code);
+		return SUCCEEDED(hr);
+	}
+
+	// Buffers for `count` keys; they only grow
+	bool Reserve(int count)
+	{
+		if (count <= m_capacity) return true;
+		ReleaseBuffers();
+		int capacity = (std::min)(kSortMaxCount, ((count + count / 4) + kSortTile - 1) / kSortTile * kSortTile);
+		int tileCount = capacity / kSortTile;
+		bool created = m_keys[0].Create(m_device, capacity) && m_keys[1].Create(m_device, capacity) &&
+			m_values[0].Create(m_device, capacity) && m_values[1].Create(m_device, capacity) &&
+			m_counts.Create(m_device, kSortRadix * tileCount) &&
+			m_blockSums.Create(m_device, kSortTile);
+		if (created)
+		{
+			D3D11_BUFFER_DESC desc;
+			memset(&desc, 0, sizeof(desc));
+			desc.ByteWidth = static_cast<UINT>(capacity) * sizeof(UINT);
+			desc.Usage = D3D11_USAGE_STAGING;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			created = SUCCEEDED(m_device->CreateBuffer(&desc, NULL, &m_readback));
+		}
+		if (!created)
+		{
+			PixelSortLog("[PixelSort] GPU sort: cannot allocate %d keys\n", capacity);
+			ReleaseBuffers();
+			return false;
+		}
+		m_capacity = capacity;
+		return true;
+	}
+
+	void ReleaseBuffers()
+	{
+		ReleaseCom(m_readback);
+		m_blockSums.Release();
+		m_counts.Release();
+		for (int i = 0; i < 2; ++i)
+		{
+			m_values[i].Release();
+			m_keys[i].Release();
+		}
+		m_capacity = 0;
+	}
+
+	// One dispatch; the views are unbound afterwards so the next pass can
+	// bind the same buffers the other way round
+	void Dispatch(ID3D11ComputeShader* shader,
+		ID3D11ShaderResourceView* const* srvs, UINT srvCount,
+		ID3D11UnorderedAccessView* const* uavs, UINT uavCount,
+		int groups)
+	{
+		static ID3D11ShaderResourceView* const kNoSrvs[4] = { NULL, NULL, NULL, NULL };
+		static ID3D11UnorderedAccessView* const kNoUavs[4] = { NULL, NULL, NULL, NULL };
+		m_context->CSSetShader(shader, NULL, 0);
+		if (srvCount > 0)
+			m_context->CSSetShaderResources(0, srvCount, srvs);
+		m_context->CSSetUnorderedAccessViews(0, uavCount, uavs, NULL);
+		m_context->Dispatch(static_cast<UINT>(groups), 1, 1);
+		m_context->CSSetShaderResources(0, 4, kNoSrvs);
+		m_context->CSSetUnorderedAccessViews(0, 4, kNoUavs, NULL);
+	}
+
+	HMODULE               m_d3d11;
+	HMODULE               m_compiler;
+	ID3D11Device*         m_device;
+	ID3D11DeviceContext*  m_context;
+	ID3D11ComputeShader*  m_countDigits;
+	ID3D11ComputeShader*  m_scanCounts;
+	ID3D11ComputeShader*  m_scanBlockSums;
+	ID3D11ComputeShader*  m_scatterKeys;
+	ID3D11Buffer*         m_constants;
+	DeviceBuffer          m_keys[2];
+	DeviceBuffer          m_values[2];
+	DeviceBuffer          m_counts;    // digit counts per tile, then their offsets
+	DeviceBuffer          m_blockSums; // sums of kSortTile counts, then their offsets
+	ID3D11Buffer*         m_readback;
+	int                   m_capacity;  // keys the buffers hold
+	char                  m_name[128];
+};
+
+// ---------------------------------------------------------------------------
+// Self-check
+// ---------------------------------------------------------------------------
+
+// Sorts a batch whose keys repeat (several tiles, a partial last tile, every
+// digit pass) and compares the order with a CPU stable sort, so a driver
+// that gets the shaders wrong only costs the GPU backend
+static bool CheckSortDevice(PixelSortDevice& device)
+{
+	const int count = 5 * kSortTile + 123;
+	const int keyBits = 18;
+	std::vector<unsigned int> keys(count), order(count), expected(count);
+	for (int i = 0; i < count; ++i)
+	{
+		keys[i] = RandomBits(0x5EED5EEDU, static_cast<unsigned int>(i)) & ((1u << keyBits) - 1);
+		if (i % 7 == 0) keys[i] &= 0xFF; // runs of equal keys
+		expected[i] = static_cast<unsigned int>(i);
+	}
+	std::stable_sort(expected.begin(), expected.end(), [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+	return device.SortKeys(keys.data(), count, keyBits, order.data()) && order == expected;
+}
+
+PixelSortDevice* CreatePixelSortDevice()
+{
+	char value[16];
+	DWORD length = GetEnvironmentVariableA("PIXELSORT_GPU", value, sizeof(value));
+	if (length > 0 && length < sizeof(value) && strcmp(value, "0") == 0)
+	{
+		PixelSortLog("[PixelSort] GPU sort disabled (PIXELSORT_GPU=0)\n");
+		return NULL;
+	}
+
+	D3D11SortDevice* device = new D3D11SortDevice;
+	if (!device->Initialize())
+	{
+		PixelSortLog("[PixelSort] GPU sort unavailable: no Direct3D 11 compute device\n");
+		delete device;
+		return NULL;
+	}
+	if (!CheckSortDevice(*device))
+	{
+		PixelSortLog("[PixelSort] GPU sort disabled: %s failed the sort check\n", device->GetName());
+		delete device;
+		return NULL;
+	}
+	return device;
+}
+
+#else
+
+PixelSortDevice* CreatePixelSortDevice()
+{
+	return NULL;
+}
+
+#endif
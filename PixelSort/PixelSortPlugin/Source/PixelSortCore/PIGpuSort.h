@@ -0,0 +1,39 @@
+//! @file   PIGpuSort.h
+//! @brief  Optional GPU sort backend (Direct3D 11 compute): stable sort of 32-bit keys
+#pragma once
+
+// Define as 0 to leave the GPU backend out: CreatePixelSortDevice then
+// always returns NULL and every pass sorts on the CPU
+#ifndef PIXELSORT_GPU
+#define PIXELSORT_GPU 1
+#endif
+
+// ---------------------------------------------------------------------------
+// Sort device
+// ---------------------------------------------------------------------------
+
+// Sorts one batch of keys at a time. The render pipeline packs every span
+// of a batch of lines into the keys (span index above the key code), so one
+// device sort orders all those spans together; see SortLinesOnDevice.
+class PixelSortDevice
+{
+public:
+	virtual ~PixelSortDevice() {}
+
+	// Adapter name, for the log
+	virtual const char* GetName() const = 0;
+
+	// Most keys a SortKeys call takes
+	virtual int GetMaxCount() const = 0;
+
+	// Stable sort of keys[0, count), all below 2^keyBits: order[j] receives
+	// the index of the key that lands in slot j. Returns false if the device
+	// failed (removed, out of memory); the caller then sorts on the CPU.
+	virtual bool SortKeys(const unsigned int* keys, int count, int keyBits, unsigned int* order) = 0;
+};
+
+// A Direct3D 11 hardware device with compute shaders, its sort shaders
+// compiled and checked against a CPU sort. NULL if there is none: not
+// Windows, no feature level 11.0 adapter, d3d11.dll or d3dcompiler_47.dll
+// missing, the check failed, or the PIXELSORT_GPU environment variable is 0.
+PixelSortDevice* CreatePixelSortDevice();
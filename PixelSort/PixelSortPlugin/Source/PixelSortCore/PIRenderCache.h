@@ -0,0 +1,172 @@
+//! @file   PIRenderCache.h
+//! @brief  LRU cache of finished full-resolution results, keyed by params
+#pragma once
+
+#include "PlugInCommon/PIPixelSort.h"
+#include <vector>
+
+// Results kept per dialog session, in bytes of packed RGB. A result larger
+// than this is never cached.
+static const size_t kRenderCacheBytes = 512u * 1024 * 1024;
+
+// ---------------------------------------------------------------------------
+// Params hash
+// ---------------------------------------------------------------------------
+
+inline unsigned long long HashParamsField(unsigned long long hash, int value)
+{
+	// FNV-1a over the field's four bytes
+	unsigned int v = static_cast<unsigned int>(value);
+	for (int b = 0; b < 4; ++b, v >>= 8)
+	{
+		hash ^= v & 0xFF;
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+// Hash of every field of clamped params (padding is never read)
+inline unsigned long long HashParams(const PixelSortParams& p)
+{
+	unsigned long long h = 0xCBF29CE484222325ULL;
+	h = HashParamsField(h, p.direction);
+	h = HashParamsField(h, p.sortKey);
+	h = HashParamsField(h, p.intervalMode);
+	h = HashParamsField(h, p.lowerThreshold);
+	h = HashParamsField(h, p.upperThreshold);
+	h = HashParamsField(h, p.reverse ? 1 : 0);
+	h = HashParamsField(h, p.jitter);
+	h = HashParamsField(h, p.spanMin);
+	h = HashParamsField(h, p.spanMax);
+	h = HashParamsField(h, p.angle);
+	h = HashParamsField(h, p.falloff);
+	h = HashParamsField(h, p.edgeScope);
+	h = HashParamsField(h, p.skipTransparent ? 1 : 0);
+	h = HashParamsField(h, p.seed);
+	return h;
+}
+
+inline bool SameParams(const PixelSortParams& a, const PixelSortParams& b)
+{
+	return a.direction == b.direction &&
+		a.sortKey == b.sortKey &&
+		a.intervalMode == b.intervalMode &&
+		a.lowerThreshold == b.lowerThreshold &&
+		a.upperThreshold == b.upperThreshold &&
+		a.reverse == b.reverse &&
+		a.jitter == b.jitter &&
+		a.spanMin == b.spanMin &&
+		a.spanMax == b.spanMax &&
+		a.angle == b.angle &&
+		a.falloff == b.falloff &&
+		a.edgeScope == b.edgeScope &&
+		a.skipTransparent == b.skipTransparent &&
+		a.seed == b.seed;
+}
+
+// ---------------------------------------------------------------------------
+// Render cache
+// ---------------------------------------------------------------------------
+
+// Finished results of one source image. A lookup matches the hash first,
+// then every field, so a collision is never a hit. When a new result does
+// not fit the budget, the least recently used ones are dropped.
+class RenderCache
+{
+public:
+	RenderCache() : m_bytes(0), m_clock(0), m_hits(0), m_misses(0) {}
+
+	// The cached result for `params`, marked as just used; NULL if none
+	const std::vector<BYTE>* Find(const PixelSortParams& params)
+	{
+		unsigned long long hash = HashParams(params);
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			Entry& e = m_entries[i];
+			if (e.hash == hash && SameParams(e.params, params))
+			{
+				e.lastUse = ++m_clock;
+				++m_hits;
+				return &e.image;
+			}
+		}
+		++m_misses;
+		return NULL;
+	}
+
+	// A buffer of `bytes` for the result of `params`, to be filled by the
+	// caller; NULL if it can never fit. Replaces any result for `params`.
+	std::vector<BYTE>* Insert(const PixelSortParams& params, size_t bytes)
+	{
+		if (bytes == 0 || bytes > kRenderCacheBytes) return NULL;
+		Remove(params);
+		while (m_bytes + bytes > kRenderCacheBytes)
+			RemoveAt(LeastRecentlyUsed());
+
+		m_entries.push_back(Entry());
+		Entry& e = m_entries.back();
+		e.params = params;
+		e.hash = HashParams(params);
+		e.lastUse = ++m_clock;
+		e.image.resize(bytes);
+		m_bytes += bytes;
+		return &e.image;
+	}
+
+	// Drops every result and frees its memory
+	void Clear()
+	{
+		std::vector<Entry>().swap(m_entries);
+		m_bytes = 0;
+		m_hits = m_misses = 0;
+	}
+
+	int    GetCount() const  { return static_cast<int>(m_entries.size()); }
+	size_t GetBytes() const  { return m_bytes; }
+	int    GetHits() const   { return m_hits; }
+	int    GetMisses() const { return m_misses; }
+
+private:
+	struct Entry
+	{
+		PixelSortParams    params;
+		unsigned long long hash;
+		unsigned long long lastUse;
+		std::vector<BYTE>  image; // packed RGB, the size of the source
+	};
+
+	void Remove(const PixelSortParams& params)
+	{
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			if (SameParams(m_entries[i].params, params))
+			{
+				RemoveAt(i);
+				return;
+			}
+		}
+	}
+
+	size_t LeastRecentlyUsed() const
+	{
+		size_t oldest = 0;
+		for (size_t i = 1; i < m_entries.size(); ++i)
+		{
+			if (m_entries[i].lastUse < m_entries[oldest].lastUse)
+				oldest = i;
+		}
+		return oldest;
+	}
+
+	void RemoveAt(size_t i)
+	{
+		m_bytes -= m_entries[i].image.size();
+		m_entries.erase(m_entries.begin() + i);
+	}
+
+	std::vector<Entry> m_entries;
+	size_t             m_bytes;
+	unsigned long long m_clock;
+	int                m_hits;
+	int                m_misses;
+};
@@ -0,0 +1,752 @@
+//! @file   PIRenderPipeline.cpp
+//! @brief  Staged render pipeline (layout, keys, spans, banded sort), host independent
+#include "PixelSortCore/PIRenderPipeline.h"
+#include "PlugInCommon/PIPixelCopy.h"
+#include "PlugInCommon/PISelectCoverage.h"
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+// Selection blend
+// ---------------------------------------------------------------------------
+
+// Blends [x0, x1) x [y0, y1) of the sorted image with the unsorted one
+// through the selection, in place, a task of rows per worker
+static void BlendRect(
+	const RenderContext& ctx,
+	BYTE* sorted, const BYTE* orig, const BYTE* select,
+	int fullW, int x0, int y0, int x1, int y1)
+{
+	BlendPixelsRGBFunc blend = GetPixelCopyKernel().blend;
+	ctx.pool->ParallelFor(y1 - y0, kLinesPerTask, [&](int, int begin, int end)
+	{
+		for (int y = y0 + begin; y < y0 + end; ++y)
+		{
+			size_t offset = static_cast<size_t>(y) * fullW + x0;
+			blend(sorted + offset * 3, orig + offset * 3, select + offset, sorted + offset * 3, x1 - x0);
+		}
+	});
+}
+
+// ---------------------------------------------------------------------------
+// Span-level threading
+// ---------------------------------------------------------------------------
+
+static bool HasSpanOfAtLeast(const std::vector<Span>& spans, int length)
+{
+	for (size_t s = 0; s < spans.size(); ++s)
+	{
+		if (spans[s].end - spans[s].start >= length) return true;
+	}
+	return false;
+}
+
+// Lends the pool to one scratch's span sorts for the scope. A worker's
+// scratch must never hold it inside a pool job.
+struct SpanPoolLoan
+{
+	LineScratch& scratch;
+
+	SpanPoolLoan(LineScratch& s, PixelSortThreadPool* pool) : scratch(s) { scratch.spanPool = pool; }
+	~SpanPoolLoan() { scratch.spanPool = NULL; }
+
+private:
+	SpanPoolLoan& operator=(const SpanPoolLoan&);
+};
+
+// ---------------------------------------------------------------------------
+// Device sort
+// ---------------------------------------------------------------------------
+
+// A pass's lines as the device sort reads them
+struct DeviceSortLines
+{
+	int                                    count;
+	int                                    length;   // unrotated lines: pixels a line
+	int                                    fullW;
+	bool                                   vertical;
+	const LineLayout*                      layout;   // traced lines, NULL unless angle mode
+	const KeyPlane*                        keyPlane;
+	const std::vector<std::vector<Span> >* spans;
+	const BYTE*                            select;   // mask in line order, NULL if there is no selection
+	const BYTE*                            coverage; // SelectCoverage per line, NULL if there is no selection
+
+	int Length(int i) const
+	{
+		return layout != NULL ? layout->LineLength(i) : length;
+	}
+
+	KeyLine Keys(int i) const
+	{
+		return layout != NULL ? keyPlane->Line(layout->offsets[i], layout->LineLength(i)) : keyPlane->Row(i);
+	}
+
+	SelectCoverage Coverage(int i) const
+	{
+		return coverage != NULL ? static_cast<SelectCoverage>(coverage[i]) : kSelectCoverageFull;
+	}
+
+	// NULL unless the line is partially selected
+	const BYTE* Select(int i) const
+	{
+		if (Coverage(i) != kSelectCoveragePartial) return NULL;
+		return select + (layout != NULL ? static_cast<size_t>(layout->offsets[i]) : static_cast<size_t>(i) * length);
+	}
+
+	// Image pixel (y * fullW + x) at position `pos` of line i
+	unsigned int Pixel(int i, int pos) const
+	{
+		if (layout != NULL) return static_cast<unsigned int>(layout->LinePixels(i)[pos]);
+		return vertical ? static_cast<unsigned int>(pos) * fullW + i : static_cast<unsigned int>(i) * fullW + pos;
+	}
+};
+
+// Calls fn(si, start, len, count) for every span of line i that SortLine
+// would sort, with `count` its included pixels: falloff draws and the mask are
+// applied the same way, and spans of fewer than two pixels are skipped
+template <class Fn>
+static void ForEachDeviceSpan(const DeviceSortLines& lines, const PixelSortParams& params, int i, const Fn& fn)
+{
+	const std::vector<Span>& spans = (*lines.spans)[i];
+	const BYTE* sel = lines.Select(i);
+	int n = lines.Length(i);
+	unsigned int falloffKey = params.falloff > 0 ? MakeRandomLineKey(params.seed, kRandomStreamFalloff, i) : 0;
+	for (int si = 0; si < static_cast<int>(spans.size()); ++si)
+	{
+		int start = spans[si].start;
+		int len = (std::min)(spans[si].end, n) - start;
+		if (len < 2) continue;
+		if (params.falloff > 0 && SpanFallsOff(params, falloffKey, si)) continue;
+		int count = len;
+		if (sel != NULL)
+		{
+			count = 0;
+			for (int p = start; p < start + len; ++p)
+				count += (sel[p] != 0) ? 1 : 0;
+		}
+		if (count >= 2)
+			fn(si, start, len, count);
+	}
+}
+
+static int BitWidth(unsigned int v)
+{
+	int bits = 0;
+	for (; v != 0; v >>= 1) ++bits;
+	return bits;
+}
+
+// Sorts every line of the pass on `device` into `image` (a copy of `orig`).
+// Lines go in batches of whole lines; each batch's keys hold the span's
+// index in the batch above the key code, so one stable device sort orders
+// all its spans at once and leaves ties in pixel order, as SortSpan does.
+// Reverse and jitter are then applied to each span's order on the CPU, the
+// same way SortSpan applies them. Returns false if the device failed or a
+// line does not fit a batch; `image` may then be partly sorted.
+static bool SortLinesOnDevice(
+	const RenderContext& ctx,
+	PixelSortDevice& device,
+	const DeviceSortLines& lines,
+	const PixelSortParams& params,
+	const BYTE* orig,
+	BYTE* image,
+	StageCache& stages,
+	std::vector<RenderCounts>& workerCounts)
+{
+	int lineCount = lines.count;
+	int codeBits = BitWidth(static_cast<unsigned int>(SortKeyCodeRange(params.sortKey) - 1));
+	int maxSegments = 1 << (32 - codeBits);
+	int maxElements = (std::min)(device.GetMaxCount(), kDeviceSortMaxBatch);
+
+	// Included pixels and sorted spans of every line
+	std::vector<int> lineElements(lineCount, 0);
+	std::vector<int> lineSegments(lineCount, 0);
+	ctx.pool->ParallelFor(lineCount, kLinesPerTask, [&](int worker, int begin, int end)
+	{
+		RenderCounts counts = { 0, 0, 0 };
+		for (int i = begin; i < end; ++i)
+		{
+			if (lines.Coverage(i) == kSelectCoverageNone) continue;
+			CountSortedLine(counts, (*lines.spans)[i]);
+			ForEachDeviceSpan(lines, params, i, [&](int, int, int, int count)
+			{
+				lineElements[i] += count;
+				++lineSegments[i];
+			});
+		}
+		AddRenderCounts(workerCounts[worker], counts);
+	});
+
+	std::vector<int> lineBase(lineCount); // first element of each line in its batch
+	int batchBegin = 0;
+	while (batchBegin < lineCount)
+	{
+		// Whole lines while the keys and the span index bits last
+		int elements = 0, segments = 0;
+		int batchEnd = batchBegin;
+		for (; batchEnd < lineCount; ++batchEnd)
+		{
+			if (elements + lineElements[batchEnd] > maxElements || segments + lineSegments[batchEnd] > maxSegments)
+				break;
+			lineBase[batchEnd] = elements;
+			elements += lineElements[batchEnd];
+			segments += lineSegments[batchEnd];
+		}
+		if (batchEnd == batchBegin)
+		{
+			PixelSortLog("[PixelSort] Device sort: line %d does not fit a batch\n", batchBegin);
+			return false;
+		}
+
+		if (elements > 0)
+		{
+			// Keys and pixels of the batch, in line order
+			std::vector<unsigned int>& keys = stages.deviceKeys;
+			std::vector<unsigned int>& pixels = stages.devicePixels;
+			std::vector<unsigned int>& order = stages.deviceOrder;
+			keys.resize(elements);
+			pixels.resize(elements);
+			order.resize(elements);
+
+			std::vector<int> segmentBase(batchEnd - batchBegin + 1, 0);
+			for (int i = batchBegin; i < batchEnd; ++i)
+				segmentBase[i - batchBegin + 1] = segmentBase[i - batchBegin] + lineSegments[i];
+
+			ctx.pool->ParallelFor(batchEnd - batchBegin, kLinesPerTask, [&](int, int begin, int end)
+			{
+				for (int i = batchBegin + begin; i < batchBegin + end; ++i)
+				{
+					if (lineElements[i] == 0) continue;
+					KeyLine codes = lines.Keys(i);
+					const BYTE* sel = lines.Select(i);
+					unsigned int segment = static_cast<unsigned int>(segmentBase[i - batchBegin]);
+					int e = lineBase[i];
+					ForEachDeviceSpan(lines, params, i, [&](int, int start, int len, int)
+					{
+						unsigned int high = segment++ << codeBits;
+						for (int p = start; p < start + len; ++p)
+						{
+							if (sel != NULL && sel[p] == 0) continue;
+							keys[e] = high | codes.at(p);
+							pixels[e] = lines.Pixel(i, p);
+							++e;
+						}
+					});
+				}
+			});
+
+			int keyBits = codeBits + BitWidth(static_cast<unsigned int>(segments - 1));
+			if (!device.SortKeys(keys.data(), elements, keyBits, order.data()))
+				return false;
+
+			// Each span's order, reversed and jittered like SortSpan's records,
+			// then its pixels written back to its included positions
+			ctx.pool->ParallelFor(batchEnd - batchBegin, kLinesPerTask, [&](int worker, int begin, int end)
+			{
+				LineScratch& scratch = (*ctx.scratches)[worker];
+				for (int i = batchBegin + begin; i < batchBegin + end; ++i)
+				{
+					if (lineElements[i] == 0) continue;
+					unsigned int jitterLineKey = params.jitter > 0 ? MakeRandomLineKey(params.seed, kRandomStreamJitter, i) : 0;
+					int e = lineBase[i];
+					ForEachDeviceSpan(lines, params, i, [&](int si, int, int, int count)
+					{
+						std::vector<int>& spanOrder = scratch.includedIndices;
+						spanOrder.assign(order.begin() + e, order.begin() + e + count);
+						if (params.reverse)
+							std::reverse(spanOrder.begin(), spanOrder.end());
+						if (params.jitter > 0)
+							JitterOrder(spanOrder.data(), count, params, MakeRandomSpanKey(jitterLineKey, si),
+								scratch.jitterTargets, NULL);
+						for (int k = 0; k < count; ++k)
+						{
+							const BYTE* src = orig + static_cast<size_t>(pixels[spanOrder[k]]) * 3;
+							BYTE* dst = image + static_cast<size_t>(pixels[e + k]) * 3;
+							dst[0] = src[0];
+							dst[1] = src[1];
+							dst[2] = src[2];
+						}
+						e += count;
+					});
+				}
+			});
+		}
+		batchBegin = batchEnd;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Render
+// ---------------------------------------------------------------------------
+
+const RenderTuning& ContextTuning(const RenderContext& ctx)
+{
+	static const RenderTuning defaults = MakeDefaultTuning();
+	return (ctx.tuning != NULL) ? *ctx.tuning : defaults;
+}
+
+RenderStatus RenderImage(
+	const RenderContext& ctx,
+	const SourceImage& source,
+	StageCache& stages,
+	const PixelSortParams& params)
+{
+	int fullW = source.width;
+	int fullH = source.height;
+	const std::vector<BYTE>& origImage = source.image; // unsorted pixels for selection blending
+	const std::vector<BYTE>& fullSelect = source.select;
+	bool hasSelection = !fullSelect.empty();
+	KeyPlane& keyPlane = stages.keyPlane;
+	std::vector<BYTE>& fullImage = stages.fullImage;
+
+	// Decide which cached stages still hold for these params
+	bool useAngle = ParamsUseAngle(params);
+	bool rotationValid = stages.rotationValid && SameRotationStage(stages.params, params);
+	bool keysValid = rotationValid && stages.keysValid && SameKeyStage(stages.params, params);
+	bool spansValid = rotationValid && stages.spansValid && SameSpanStage(stages.params, params);
+	bool vertical = ParamsUseColumns(params);
+	stages.imageValid = false;
+	ApplySortTuning(ctx);
+
+	// Large passes sort on the device, into fullImage. Otherwise unrotated
+	// horizontal full-resolution passes sort straight into the target.
+	// Vertical passes keep the full-image buffer: columns come back from
+	// scratch a task at a time.
+	bool onDevice = ctx.device != NULL &&
+		static_cast<double>(fullW) * fullH >= DeviceSortMinPixels(ContextTuning(ctx), params, hasSelection);
+	bool inPlace = !onDevice && ctx.pushBands && !useAngle && !vertical;
+	PixelSortRenderTarget* target = ctx.target;
+	if (inPlace)
+		target->BeginRows();
+	PixelSortLog("[PixelSort] Stages rebuilt (%dx%d): rotate=%d keys=%d spans=%d inPlace=%d device=%d\n", fullW, fullH,
+		rotationValid ? 0 : 1, keysValid ? 0 : 1, spansValid ? 0 : 1, inPlace ? 1 : 0, onDevice ? 1 : 0);
+
+	// Stage 1: line layout (angle or transpose). Lines are traced through
+	// the image itself, so every pixel is sorted exactly once and no rotated
+	// copy is needed. The selection is gathered into line order with it.
+	RenderStats stats = MakeRenderStats();
+	RenderStageClock clock;
+	LineLayout& layout = stages.lines;
+	if (!rotationValid)
+	{
+		if (vertical)
+		{
+			layout.Clear();
+			stages.lineSelect.resize(hasSelection ? fullSelect.size() : 0);
+			if (hasSelection)
+			{
+				ctx.pool->ParallelFor(fullW, kLinesPerTask, [&](int, int begin, int end)
+				{
+					TransposePixels(fullSelect.data() + begin, fullW,
+						stages.lineSelect.data() + static_cast<size_t>(begin) * fullH, fullH,
+						1, end - begin, fullH);
+				});
+			}
+		}
+		else if (useAngle)
+		{
+			layout.Build(fullW, fullH, params.angle);
+			stages.lineSelect.resize(hasSelection ? fullSelect.size() : 0);
+			if (hasSelection)
+			{
+				ctx.pool->ParallelFor(layout.LineCount(), kLinesPerTask, [&](int, int begin, int end)
+				{
+					for (int j = layout.offsets[begin]; j < layout.offsets[end]; ++j)
+						stages.lineSelect[j] = fullSelect[layout.pixels[j]];
+				});
+			}
+		}
+		else
+		{
+			layout.Clear();
+			stages.lineSelect.clear();
+		}
+
+		// Coverage of every line's selection, in line order
+		int coverageLines = useAngle ? layout.LineCount() : (vertical ? fullW : fullH);
+		stages.lineCoverage.resize(hasSelection ? coverageLines : 0);
+		if (hasSelection)
+		{
+			ctx.pool->ParallelFor(coverageLines, kLinesPerTask, [&](int, int begin, int end)
+			{
+				for (int i = begin; i < end; ++i)
+				{
+					const BYTE* mask;
+					int length;
+					if (useAngle)
+					{
+						mask = stages.lineSelect.data() + layout.offsets[i];
+						length = layout.LineLength(i);
+					}
+					else if (vertical)
+					{
+						mask = stages.lineSelect.data() + static_cast<size_t>(i) * fullH;
+						length = fullH;
+					}
+					else
+					{
+						mask = fullSelect.data() + static_cast<size_t>(i) * fullW;
+						length = fullW;
+					}
+					stages.lineCoverage[i] = static_cast<BYTE>(MaskCoverage(mask, length));
+				}
+			});
+		}
+	}
+
+	stats.layout = clock.Lap();
+
+	// Lines with no selected pixel are neither span-detected nor sorted;
+	// fully selected lines sort without the mask
+	auto lineCoverage = [&](int i) -> SelectCoverage
+	{
+		return hasSelection ? static_cast<SelectCoverage>(stages.lineCoverage[i]) : kSelectCoverageFull;
+	};
+
+	// The sort buffer starts as a copy of the unsorted source each pass.
+	// Vertical passes fill fullImage from the sorted column strips instead
+	// (device sorts start from the copy too).
+	const BYTE* unsortedBuf = origImage.data();
+	BYTE* sortBuf = NULL;
+	if (vertical && !onDevice)
+	{
+		fullImage.resize(origImage.size());
+	}
+	else if (!inPlace)
+	{
+		fullImage.assign(origImage.begin(), origImage.end());
+		if (!vertical)
+			sortBuf = fullImage.data();
+	}
+
+	// Copies columns [begin, end) of the unsorted image into the worker's
+	// strip, one packed RGB row of fullH pixels per column
+	auto transposeColumns = [&](LineScratch& scratch, int begin, int end) -> BYTE*
+	{
+		scratch.columnStrip.resize(static_cast<size_t>(end - begin) * fullH * 3);
+		TransposePixels(unsortedBuf + begin * 3, static_cast<size_t>(fullW) * 3,
+			scratch.columnStrip.data(), static_cast<size_t>(fullH) * 3, 3, end - begin, fullH);
+		return scratch.columnStrip.data();
+	};
+
+	// Stage 2: key plane (sort key). Every pixel's key is computed once;
+	// span detection and sorting both read it. Vertical passes key the
+	// transposed columns, so every line is a contiguous key row.
+	int rowCount = vertical ? fullW : fullH;
+	clock.Lap();
+	if (!keysValid)
+	{
+		keyPlane.Allocate(vertical ? fullH : fullW, rowCount, params.sortKey, params.intervalMode);
+		ctx.pool->ParallelFor(rowCount, kLinesPerTask, [&](int worker, int begin, int end)
+		{
+			if (!vertical)
+			{
+				keyPlane.BuildRows(unsortedBuf, params.sortKey, begin, end);
+				return;
+			}
+			const BYTE* strip = transposeColumns((*ctx.scratches)[worker], begin, end);
+			for (int x = begin; x < end; ++x)
+				keyPlane.BuildRow(strip + static_cast<size_t>(x - begin) * fullH * 3, params.sortKey, x);
+		});
+		if (useAngle)
+		{
+			keyPlane.AllocateLines();
+			ctx.pool->ParallelFor(layout.LineCount(), kLinesPerTask, [&](int, int begin, int end)
+			{
+				keyPlane.GatherLines(layout.pixels.data(), layout.offsets[begin], layout.offsets[end]);
+			});
+		}
+	}
+
+	stats.keys = clock.Lap();
+
+	// Stage 3: span detection (mode, thresholds, span limits)
+	int lineCount = useAngle ? layout.LineCount() : rowCount;
+	if (!spansValid)
+	{
+		// Never shrunk, so every line's list keeps its capacity
+		if (static_cast<int>(stages.lineSpans.size()) < lineCount)
+			stages.lineSpans.resize(lineCount);
+
+		auto brightnessLine = [&](int i) -> KeyLine
+		{
+			return useAngle ? keyPlane.BrightnessLine(layout.offsets[i], layout.LineLength(i)) : keyPlane.BrightnessRow(i);
+		};
+		int edgeLimit = kEdgeLimitPerLine;
+		if (ParamsUseImageEdgeLimit(params))
+			edgeLimit = EdgeSplitLimit(SumLineEdgeStats(ctx, lineCount, brightnessLine));
+
+		ctx.pool->ParallelFor(lineCount, kLinesPerTask, [&](int, int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				if (lineCoverage(i) == kSelectCoverageNone)
+				{
+					stages.lineSpans[i].clear();
+					continue;
+				}
+				KeyLine keys = useAngle ? keyPlane.Line(layout.offsets[i], layout.LineLength(i)) : keyPlane.Row(i);
+				DetectSpans(keys, brightnessLine(i), params, edgeLimit, i, stages.lineSpans[i]);
+			}
+		});
+	}
+
+	stats.spans = clock.Lap();
+
+	stages.params = params;
+	stages.rotationValid = true;
+	stages.keysValid = true;
+	stages.spansValid = true;
+
+	// Stage 4: sort rows or columns in bands. Each band is spread over the
+	// worker pool; between bands the host can cancel a stale render, and
+	// finished lines are pushed to the target as they land.
+	int bandLines = (std::max)(kLinesPerTask * ctx.pool->GetThreadCount(),
+		(lineCount + kBandsPerRender - 1) / kBandsPerRender);
+	int bandCount = (lineCount + bandLines - 1) / bandLines;
+	if (ctx.pushBands)
+		target->SetProgressTotal(bandCount);
+
+	// Angle mode: rows (x-major lines) or columns (y-major lines) already
+	// pushed to the target
+	int unitsPushed = 0;
+
+	// Line kernels for these params, one per kind of line
+	SortLineKernel<RowAccessor>        blockKernel  = SelectSortLineKernel<RowAccessor>(params);
+	SortLineKernel<PackedRowAccessor>  packedKernel = SelectSortLineKernel<PackedRowAccessor>(params);
+	SortLineKernel<IndexedRowAccessor> tracedKernel = SelectSortLineKernel<IndexedRowAccessor>(params);
+
+	// Counts per worker, added up once the pass ends
+	std::vector<RenderCounts> workerCounts(ctx.scratches->size(), stats.counts);
+
+	// Sorts line i (not unselected). `column` is its packed row in the
+	// worker's column strip for vertical passes.
+	auto sortLine = [&](int worker, LineScratch& scratch, int i, SelectCoverage coverage, BYTE* column)
+	{
+		bool masked = (coverage == kSelectCoveragePartial);
+		const BYTE* selLine = NULL;
+		if (useAngle)
+		{
+			IndexedRowAccessor traced;
+			traced.imageBase = sortBuf;
+			traced.indices = layout.LinePixels(i);
+			traced.length = layout.LineLength(i);
+			if (masked)
+				selLine = stages.lineSelect.data() + layout.offsets[i];
+			tracedKernel.Sort(traced, keyPlane.Line(layout.offsets[i], traced.length), stages.lineSpans[i],
+				params, selLine, i, scratch);
+			return;
+		}
+
+		if (masked)
+			selLine = vertical ? stages.lineSelect.data() + static_cast<size_t>(i) * fullH : fullSelect.data() + i * fullW;
+
+		if (inPlace)
+		{
+			const BYTE* src = origImage.data() + static_cast<size_t>(i) * fullW * 3;
+			RowAccessor line;
+			if (target->BeginRow(worker, i, src, masked, scratch, line))
+			{
+				packedKernel.Sort(StagedRow(scratch, fullW), keyPlane.Row(i), stages.lineSpans[i], params, selLine, i, scratch);
+				if (masked)
+					BlendStagedRow(src, selLine, fullW, scratch);
+				target->FlushStagedRow(worker, i, scratch);
+			}
+			else
+			{
+				blockKernel.Sort(line, keyPlane.Row(i), stages.lineSpans[i], params, selLine, i, scratch);
+			}
+			return;
+		}
+
+		PackedRowAccessor line;
+		line.imageBase = vertical ? column : sortBuf + i * fullW * 3;
+		line.length = vertical ? fullH : fullW;
+
+		packedKernel.Sort(line, keyPlane.Row(i), stages.lineSpans[i],
+			params, selLine, i, scratch);
+	};
+
+	// Device pass: every line is sorted before the first band, and the bands
+	// only blend and push. If the device fails, the CPU sorts the pass from
+	// a fresh copy.
+	bool deviceSorted = false;
+	if (onDevice)
+	{
+		DeviceSortLines lines;
+		lines.count = lineCount;
+		lines.length = vertical ? fullH : fullW;
+		lines.fullW = fullW;
+		lines.vertical = vertical;
+		lines.layout = useAngle ? &layout : NULL;
+		lines.keyPlane = &keyPlane;
+		lines.spans = &stages.lineSpans;
+		lines.select = hasSelection ? (useAngle || vertical ? stages.lineSelect.data() : fullSelect.data()) : NULL;
+		lines.coverage = hasSelection ? stages.lineCoverage.data() : NULL;
+
+		std::vector<RenderCounts> deviceCounts(workerCounts.size(), stats.counts);
+		clock.Lap();
+		deviceSorted = SortLinesOnDevice(ctx, *ctx.device, lines, params, origImage.data(), fullImage.data(),
+			stages, deviceCounts);
+		stats.sort += clock.Lap();
+		if (deviceSorted)
+		{
+			workerCounts.swap(deviceCounts);
+		}
+		else
+		{
+			PixelSortLog("[PixelSort] Device sort failed; sorting on the CPU\n");
+			if (!vertical)
+				fullImage.assign(origImage.begin(), origImage.end());
+		}
+	}
+
+	// Too few lines to keep every worker busy: lines with a span long enough
+	// to split leave the line tasks and are sorted after them, one at a time
+	// on this thread, their long spans over the whole pool
+	int threadCount = ctx.pool->GetThreadCount();
+	bool splitSpans = false;
+	if (threadCount > 1 && !deviceSorted)
+	{
+		int activeLines = lineCount;
+		if (hasSelection)
+			activeLines = lineCount - static_cast<int>(std::count(stages.lineCoverage.begin(),
+				stages.lineCoverage.begin() + lineCount, static_cast<BYTE>(kSelectCoverageNone)));
+		splitSpans = activeLines < kLinesPerTask * threadCount;
+	}
+	std::vector<std::vector<int> > splitLines(splitSpans ? ctx.scratches->size() : 0); // per worker
+
+	RenderStatus status = kRenderStatusDone;
+	bool cancellable = ctx.cancellable;
+	for (int band = 0; band < bandCount; ++band)
+	{
+		int lineBegin = band * bandLines;
+		int lineEnd = (std::min)(lineCount, lineBegin + bandLines);
+
+		clock.Lap();
+		if (!deviceSorted)
+		{
+			ctx.pool->ParallelFor(lineEnd - lineBegin, kLinesPerTask, [&](int worker, int begin, int end)
+			{
+				LineScratch& scratch = (*ctx.scratches)[worker];
+				RenderCounts counts = { 0, 0, 0 };
+				int taskBegin = lineBegin + begin;
+				BYTE* strip = vertical ? transposeColumns(scratch, taskBegin, lineBegin + end) : NULL;
+				for (int i = lineBegin + begin; i < lineBegin + end; ++i)
+				{
+					SelectCoverage coverage = lineCoverage(i);
+					if (coverage == kSelectCoverageNone) continue;
+					CountSortedLine(counts, stages.lineSpans[i]);
+					if (splitSpans && HasSpanOfAtLeast(stages.lineSpans[i], kParallelSortMinCount))
+					{
+						splitLines[worker].push_back(i);
+						continue;
+					}
+					sortLine(worker, scratch, i, coverage, vertical ? strip + static_cast<size_t>(i - taskBegin) * fullH * 3 : NULL);
+				}
+
+				// Sorted columns go back to fullImage while the strip is in cache
+				// (split columns are rewritten when they are sorted)
+				if (vertical)
+				{
+					TransposePixels(strip, static_cast<size_t>(fullH) * 3,
+						fullImage.data() + taskBegin * 3, static_cast<size_t>(fullW) * 3, 3, fullH, end - begin);
+				}
+				AddRenderCounts(workerCounts[worker], counts);
+			});
+
+			// The pool is idle now: lend it to worker 0's span sorts
+			if (splitSpans)
+			{
+				LineScratch& scratch = (*ctx.scratches)[0];
+				SpanPoolLoan loan(scratch, ctx.pool);
+				for (size_t w = 0; w < splitLines.size(); ++w)
+				{
+					for (size_t k = 0; k < splitLines[w].size(); ++k)
+					{
+						int i = splitLines[w][k];
+						BYTE* column = vertical ? transposeColumns(scratch, i, i + 1) : NULL;
+						sortLine(0, scratch, i, lineCoverage(i), column);
+						if (vertical)
+						{
+							TransposePixels(column, static_cast<size_t>(fullH) * 3,
+								fullImage.data() + i * 3, static_cast<size_t>(fullW) * 3, 3, fullH, 1);
+						}
+					}
+					splitLines[w].clear();
+				}
+			}
+		}
+		stats.sort += clock.Lap();
+
+		// Blend the finished part of fullImage with the source where the
+		// selection is partial, then push it
+		if (inPlace)
+		{
+			target->RowsUpdated(lineBegin, lineEnd);
+		}
+		else
+		{
+			int x0 = 0, y0 = 0, x1 = fullW, y1 = fullH;
+			if (!useAngle)
+			{
+				if (vertical) { x0 = lineBegin; x1 = lineEnd; }
+				else          { y0 = lineBegin; y1 = lineEnd; }
+			}
+			else
+			{
+				int unitsDone = layout.UnitsComplete(lineEnd);
+				if (layout.xMajor) { y0 = unitsPushed; y1 = unitsDone; }
+				else               { x0 = unitsPushed; x1 = unitsDone; }
+				unitsPushed = unitsDone;
+			}
+			if (x0 < x1 && y0 < y1)
+			{
+				if (hasSelection)
+				{
+					BlendRect(ctx, fullImage.data(), origImage.data(), fullSelect.data(), fullW, x0, y0, x1, y1);
+					stats.blend += clock.Lap();
+				}
+				if (ctx.pushBands)
+					target->WriteRect(fullImage.data(), fullW, x0, y0, x1, y1);
+			}
+		}
+
+		if (ctx.pushBands)
+			target->SetProgressDone(band + 1);
+		stats.write += clock.Lap();
+
+		if (cancellable && band + 1 < bandCount)
+		{
+			RenderStatus polled = target->Poll();
+			if (polled == kRenderStatusRestart)
+			{
+				PixelSortLog("[PixelSort] Render cancelled after band %d/%d\n", band + 1, bandCount);
+				status = kRenderStatusRestart;
+				break;
+			}
+			if (polled == kRenderStatusExit)
+			{
+				// The dialog closed; finish so the destination is complete
+				status = kRenderStatusExit;
+				cancellable = false;
+			}
+		}
+	}
+
+	stages.imageValid = !inPlace && status != kRenderStatusRestart;
+
+	if (ctx.stats != NULL)
+	{
+		RenderStats& total = *ctx.stats;
+		total.layout += stats.layout;
+		total.keys += stats.keys;
+		total.spans += stats.spans;
+		total.sort += stats.sort;
+		total.blend += stats.blend;
+		total.write += stats.write;
+		for (size_t w = 0; w < workerCounts.size(); ++w)
+			AddRenderCounts(total.counts, workerCounts[w]);
+	}
+	return status;
+}
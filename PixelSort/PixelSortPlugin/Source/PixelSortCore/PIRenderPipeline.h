@@ -0,0 +1,215 @@
+//! @file   PIRenderPipeline.h
+//! @brief  Staged render pipeline (layout, keys, spans, banded sort), host independent
+#pragma once
+
+#include "PixelSortCore/PIGpuSort.h"
+#include "PixelSortCore/PIRenderStats.h"
+#include "PixelSortCore/PIRenderTuning.h"
+#include "PlugInCommon/PIPixelSort.h"
+#include "PlugInCommon/PIEdgeScan.h"
+#include "PlugInCommon/PIKeyPlane.h"
+#include "PlugInCommon/PILineTrace.h"
+#include "PlugInCommon/PISortLine.h"
+#include "PlugInCommon/PISpanDetector.h"
+#include "PlugInCommon/PIThreadPool.h"
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Line scheduling
+// ---------------------------------------------------------------------------
+
+static const int kLinesPerTask = 16; // neighbouring columns stay on one worker
+static const int kBandsPerRender = 16; // cancellation / progress points per render
+
+// Passes of this many pixels or more sort on the context's device, if it has
+// one and no tuning profile says otherwise; below it the upload and readback
+// cost more than the sort saves
+static const double kDeviceSortMinPixels = 4.0 * 1024 * 1024;
+
+// Keys per device sort: batches of whole lines, so the CPU-side buffers stay
+// bounded (about 12 bytes a key)
+static const int kDeviceSortMaxBatch = 16 * 1024 * 1024;
+
+// ---------------------------------------------------------------------------
+// Source image
+// ---------------------------------------------------------------------------
+
+// The unsorted pixels of one render: the plugin's cached select area, its
+// proxy, or a benchmark image
+struct SourceImage
+{
+	std::vector<BYTE> image;  // packed RGB
+	std::vector<BYTE> select; // 0-255 per pixel, empty if there is no selection
+	int               width;
+	int               height;
+
+	SourceImage() : width(0), height(0) {}
+};
+
+// ---------------------------------------------------------------------------
+// Intermediate results kept across preview restarts
+// ---------------------------------------------------------------------------
+
+// Each stage is rebuilt only when a param it reads changes (see
+// SameRotationStage, SameKeyStage and SameSpanStage). `params` holds the
+// values every valid stage was built with.
+struct StageCache
+{
+	PixelSortParams                 params;
+	bool                            rotationValid;
+	bool                            keysValid;
+	bool                            spansValid;
+
+	// Traced lines for angle mode, and the selection in line order (traced
+	// lines, or columns for vertical passes)
+	LineLayout                      lines;
+	std::vector<BYTE>               lineSelect;
+	std::vector<BYTE>               lineCoverage; // SelectCoverage per line, empty if there is no selection
+
+	KeyPlane                        keyPlane;
+	std::vector<std::vector<Span> > lineSpans; // one list per row, column or traced line
+
+	// Working buffer: the sorted image (left stale by in-place passes)
+	std::vector<BYTE>               fullImage;
+	bool                            imageValid; // fullImage holds the last pass's finished result
+
+	// Device sorts: one batch's keys, their pixels and the sorted order
+	std::vector<unsigned int>       deviceKeys;
+	std::vector<unsigned int>       devicePixels;
+	std::vector<unsigned int>       deviceOrder;
+
+	StageCache()
+		: params(MakeDefaultParams())
+		, rotationValid(false)
+		, keysValid(false)
+		, spansValid(false)
+		, imageValid(false)
+	{
+	}
+
+	// New source pixels: every stage must be rebuilt, buffers are kept
+	void Invalidate()
+	{
+		rotationValid = false;
+		keysValid = false;
+		spansValid = false;
+		imageValid = false;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Render target (where finished bands go)
+// ---------------------------------------------------------------------------
+
+enum RenderStatus
+{
+	kRenderStatusDone    = 0,
+	kRenderStatusRestart = 1, // host asked for a restart; the rest of the render was dropped
+	kRenderStatusExit    = 2  // host asked to exit; the render was still finished
+};
+
+// The plugin implements this over the destination offscreen; the benchmark
+// over a buffer in memory. Row calls come from pool workers, the others
+// from the rendering thread between bands.
+class PixelSortRenderTarget
+{
+public:
+	virtual ~PixelSortRenderTarget() {}
+
+	// In-place passes (unrotated horizontal rows) sort straight in the
+	// target's memory. BeginRows starts such a pass. BeginRow points `row`
+	// at row y, filled from `src` (its packed RGB source pixels); when the
+	// row cannot be sorted in place, or must be blended (`staged`), it is
+	// staged in scratch.lineStaging instead (returns true) and written out
+	// by FlushStagedRow.
+	virtual void BeginRows() = 0;
+	virtual bool BeginRow(int worker, int y, const BYTE* src, bool staged, LineScratch& scratch, RowAccessor& row) = 0;
+	virtual void FlushStagedRow(int worker, int y, const LineScratch& scratch) = 0;
+
+	// Rows [y0, y1) were sorted in place
+	virtual void RowsUpdated(int y0, int y1) = 0;
+
+	// [x0, x1) x [y0, y1) of the packed RGB `image` (`width` pixels a row)
+	// is final
+	virtual void WriteRect(const BYTE* image, int width, int x0, int y0, int x1, int y1) = 0;
+
+	virtual void SetProgressTotal(int total) = 0;
+	virtual void SetProgressDone(int done) = 0;
+
+	// Between bands: whether the host wants the render dropped (restart) or
+	// finished as the final result (exit)
+	virtual RenderStatus Poll() = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Render context
+// ---------------------------------------------------------------------------
+
+struct RenderContext
+{
+	PixelSortThreadPool*      pool;
+	std::vector<LineScratch>* scratches;   // one per worker
+	PixelSortRenderTarget*    target;      // NULL if neither pushBands nor cancellable
+	bool                      pushBands;   // write finished bands to the target and report progress
+	bool                      cancellable; // poll the target between bands
+	RenderStats*              stats;       // stage times and counts are added here; NULL: not counted
+	PixelSortDevice*          device;      // GPU sort backend; NULL: every pass sorts on the CPU
+	const RenderTuning*       tuning;      // engine choices of this machine; NULL: built-in defaults
+};
+
+// ctx.tuning, or the built-in defaults
+const RenderTuning& ContextTuning(const RenderContext& ctx);
+
+// Points every worker's sort engine at the tuned counting sort range
+inline void ApplySortTuning(const RenderContext& ctx)
+{
+	int countingMaxRange = ContextTuning(ctx).countingSortMaxRange;
+	std::vector<LineScratch>& scratches = *ctx.scratches;
+	for (size_t w = 0; w < scratches.size(); ++w)
+		scratches[w].sortWork.countingMaxRange = countingMaxRange;
+}
+
+// Gradient statistics of lines [0, lineCount) for an image-wide Edges
+// threshold; lineCodes(i) returns line i's brightness codes. Each worker sums
+// its own lines, then the workers' sums are added.
+template <class LineCodes>
+EdgeStats SumLineEdgeStats(const RenderContext& ctx, int lineCount, const LineCodes& lineCodes)
+{
+	std::vector<LineScratch>& scratches = *ctx.scratches;
+	for (size_t w = 0; w < scratches.size(); ++w)
+		scratches[w].edgeStats = MakeEdgeStats();
+
+	AccumulateEdgeStatsFunc accumulate = GetEdgeKernel().accumulate;
+	ctx.pool->ParallelFor(lineCount, kLinesPerTask, [&](int worker, int begin, int end)
+	{
+		EdgeStats& stats = scratches[worker].edgeStats;
+		for (int i = begin; i < end; ++i)
+		{
+			KeyLine line = lineCodes(i);
+			accumulate(line.base, line.length, stats);
+		}
+	});
+
+	EdgeStats total = MakeEdgeStats();
+	for (size_t w = 0; w < scratches.size(); ++w)
+		AddEdgeStats(total, scratches[w].edgeStats);
+	return total;
+}
+
+// ---------------------------------------------------------------------------
+// Render
+// ---------------------------------------------------------------------------
+
+// Sorts `source` with `params`, reusing whatever stages of `stages` still
+// hold. The result is left in stages.fullImage, except for unrotated
+// horizontal passes that push bands: those sort straight into the target
+// (each row starts from the source), with no full-image copy. Vertical
+// passes transpose a task's columns into scratch, sort them there as
+// contiguous rows and transpose them back. Passes of DeviceSortMinPixels
+// or more sort every line on ctx.device instead, if there is one, then push
+// bands like any full-image pass.
+RenderStatus RenderImage(
+	const RenderContext& ctx,
+	const SourceImage& source,
+	StageCache& stages,
+	const PixelSortParams& params);
@@ -0,0 +1,151 @@
+//! @file   PIRenderStats.h
+//! @brief  Per-render stage timings and counters, with a summary line per render
+#pragma once
+
+#include "PlugInCommon/PIPixelSort.h"
+
+// Define as 0 to compile every stage clock and counter out: clocks read 0,
+// counters are never updated and no summary line is written
+#ifndef PIXELSORT_RENDER_STATS
+#define PIXELSORT_RENDER_STATS 1
+#endif
+
+// ---------------------------------------------------------------------------
+// Render stats
+// ---------------------------------------------------------------------------
+
+// What one pass reads, sorts and writes
+struct RenderCounts
+{
+	long long lines;  // lines sorted (lines with no selected pixel are skipped)
+	long long spans;  // spans sorted
+	long long pixels; // pixels inside those spans
+};
+
+// Wall time of each stage of one pass, in seconds, and its counters.
+// Stages served from the cache take no time. Stages fused into one worker
+// loop are timed together: vertical passes transpose their columns back
+// inside `sort`, and streaming passes key, detect and sort each row there.
+struct RenderStats
+{
+	double       gather; // source pixels read from the host (first pass only)
+	double       layout; // stage 1: line layout and selection coverage
+	double       keys;   // stage 2: key plane
+	double       spans;  // stage 3: span detection
+	double       sort;   // stage 4: line sorts
+	double       blend;  // stage 4: selection blend of finished bands
+	double       write;  // stage 4: writes to the target and progress
+	RenderCounts counts;
+	int          restarts; // restarts so far in this dialog session
+};
+
+inline RenderStats MakeRenderStats()
+{
+	RenderStats stats = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, { 0, 0, 0 }, 0 };
+	return stats;
+}
+
+inline void AddRenderCounts(RenderCounts& total, const RenderCounts& part)
+{
+	total.lines += part.lines;
+	total.spans += part.spans;
+	total.pixels += part.pixels;
+}
+
+inline double RenderStatsSeconds(const RenderStats& stats)
+{
+	return stats.gather + stats.layout + stats.keys + stats.spans + stats.sort + stats.blend + stats.write;
+}
+
+// ---------------------------------------------------------------------------
+// Stage clock
+// ---------------------------------------------------------------------------
+
+// Lap() returns the seconds since construction or the previous lap. Compiled
+// out, it never reads the clock and always returns 0.
+class RenderStageClock
+{
+public:
+	RenderStageClock()
+#if PIXELSORT_RENDER_STATS
+		: m_start(PixelSortSeconds())
+#endif
+	{
+	}
+
+	double Lap()
+	{
+#if PIXELSORT_RENDER_STATS
+		double now = PixelSortSeconds();
+		double seconds = now - m_start;
+		m_start = now;
+		return seconds;
+#else
+		return 0.0;
+#endif
+	}
+
+private:
+#if PIXELSORT_RENDER_STATS
+	double m_start;
+#endif
+};
+
+// Counts one sorted line and the spans it was sorted in
+template <class SpanList>
+inline void CountSortedLine(RenderCounts& counts, const SpanList& spans)
+{
+#if PIXELSORT_RENDER_STATS
+	counts.lines += 1;
+	counts.spans += static_cast<long long>(spans.size());
+	for (size_t s = 0; s < spans.size(); ++s)
+		counts.pixels += spans[s].end - spans[s].start;
+#else
+	(void)counts;
+	(void)spans;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Summary sink
+// ---------------------------------------------------------------------------
+
+// Every summary also goes to this sink, if one is set (the plugin's
+// PIXELSORT_STATS_CSV file, for instance). `pass` names the pass ("full",
+// "proxy", "stream").
+typedef void (*RenderStatsSink)(const char* pass, int width, int height, const RenderStats& stats);
+
+inline RenderStatsSink& RenderStatsSinkSlot()
+{
+	static RenderStatsSink sink = NULL;
+	return sink;
+}
+
+// NULL: summaries are only logged
+inline void SetRenderStatsSink(RenderStatsSink sink)
+{
+	RenderStatsSinkSlot() = sink;
+}
+
+// One compact line per pass: stage times in ms, counters, session restarts
+inline void LogRenderStats(const char* pass, int width, int height, const RenderStats& stats)
+{
+#if PIXELSORT_RENDER_STATS
+	const RenderCounts& c = stats.counts;
+	double avgSpan = (c.spans > 0) ? static_cast<double>(c.pixels) / static_cast<double>(c.spans) : 0.0;
+	PixelSortLog("[PixelSort] Stats %s %dx%d: %.1f ms (gather %.1f layout %.1f keys %.1f spans %.1f sort %.1f blend %.1f write %.1f)"
+		" lines=%lld spans=%lld px=%lld avg=%.1f restarts=%d\n",
+		pass, width, height, RenderStatsSeconds(stats) * 1000.0,
+		stats.gather * 1000.0, stats.layout * 1000.0, stats.keys * 1000.0, stats.spans * 1000.0,
+		stats.sort * 1000.0, stats.blend * 1000.0, stats.write * 1000.0,
+		c.lines, c.spans, c.pixels, avgSpan, stats.restarts);
+	RenderStatsSink sink = RenderStatsSinkSlot();
+	if (sink != NULL)
+		sink(pass, width, height, stats);
+#else
+	(void)pass;
+	(void)width;
+	(void)height;
+	(void)stats;
+#endif
+}
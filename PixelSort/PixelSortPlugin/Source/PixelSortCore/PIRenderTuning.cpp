@@ -0,0 +1,344 @@
+//! @file   PIRenderTuning.cpp
+//! @brief  Per-machine choice of render backends, calibrated once and kept in a profile file
+#include "PixelSortCore/PIRenderTuning.h"
+#include "PixelSortCore/PIRenderPipeline.h"
+#include "PixelSortCore/PISyntheticImage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+// Renders per candidate; the best one counts, so a cold first render does
+// not decide
+static const int kCalibrationRepeats = 2;
+
+// A candidate must take under this share of the default's time to replace
+// it, so timing noise keeps the defaults
+static const double kCalibrationMargin = 0.95;
+
+// Square synthetic canvases the device threshold is measured at, largest
+// first (16, 4 and 1 megapixels)
+static const int kCalibrationSides[] = { 4096, 2048, 1024 };
+static const int kCalibrationSideCount = 3;
+
+// Canvas of the thread count and sort engine timings
+static const int kCalibrationEngineSide = 2048;
+
+static const char* const kTuningLayoutNames[kTuningLayoutCount] = { "horizontal", "vertical", "angle" };
+static const char* const kTuningCoverageNames[kTuningCoverageCount] = { "full", "partial" };
+
+static int HardwareThreads()
+{
+	return (std::max)(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+RenderTuning MakeDefaultTuning()
+{
+	RenderTuning tuning;
+	tuning.threadCount = 0;
+	tuning.countingSortMaxRange = kCountingSortMaxRange;
+	for (int l = 0; l < kTuningLayoutCount; ++l)
+	{
+		for (int c = 0; c < kTuningCoverageCount; ++c)
+			tuning.deviceSortMinPixels[l][c] = kDeviceSortMinPixels;
+	}
+	tuning.hardwareThreads = HardwareThreads();
+	tuning.deviceName[0] = '\0';
+	return tuning;
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic canvases
+// ---------------------------------------------------------------------------
+
+// The benchmark's canvas, square, with its elliptical selection when
+// `selected`
+static void MakeCalibrationImage(int side, bool selected, SourceImage& source)
+{
+	source.width = source.height = side;
+	MakeSyntheticImage(side, side, source.image);
+	source.select.clear();
+	if (selected)
+		MakeEllipseSelection(side, side, source.select);
+}
+
+static PixelSortParams CalibrationParams(TuningLayout layout, SortKey key)
+{
+	PixelSortParams params = MakeDefaultParams();
+	params.sortKey = key;
+	params.direction = (layout == kTuningLayoutVertical) ? kSortDirectionVertical : kSortDirectionHorizontal;
+	params.angle = (layout == kTuningLayoutAngle) ? 30 : 0;
+	ClampParams(params);
+	return params;
+}
+
+// ---------------------------------------------------------------------------
+// Timed renders
+// ---------------------------------------------------------------------------
+
+// One pool and its scratch; renders leave their result in `stages`
+struct CalibrationRig
+{
+	PixelSortThreadPool      pool;
+	std::vector<LineScratch> scratches;
+	StageCache               stages;
+
+	explicit CalibrationRig(int threadCount)
+		: pool(threadCount)
+		, scratches(pool.GetThreadCount())
+	{
+	}
+
+	// Best wall time of cold renders (every stage rebuilt)
+	double Time(const SourceImage& source, const PixelSortParams& params,
+		PixelSortDevice* device, const RenderTuning& tuning)
+	{
+		RenderContext ctx;
+		ctx.pool = &pool;
+		ctx.scratches = &scratches;
+		ctx.target = NULL;
+		ctx.pushBands = false;
+		ctx.cancellable = false;
+		ctx.stats = NULL;
+		ctx.device = device;
+		ctx.tuning = &tuning;
+
+		double best = 0.0;
+		for (int r = 0; r < kCalibrationRepeats; ++r)
+		{
+			stages.Invalidate();
+			double start = PixelSortSeconds();
+			RenderImage(ctx, source, stages, params);
+			double seconds = PixelSortSeconds() - start;
+			if (r == 0 || seconds < best)
+				best = seconds;
+		}
+		return best;
+	}
+
+private:
+	CalibrationRig& operator=(const CalibrationRig&);
+};
+
+// Horizontal and vertical threshold passes, the common case
+static double TimeEngines(CalibrationRig& rig, const SourceImage& source, const RenderTuning& tuning, SortKey key)
+{
+	return rig.Time(source, CalibrationParams(kTuningLayoutHorizontal, key), NULL, tuning) +
+		rig.Time(source, CalibrationParams(kTuningLayoutVertical, key), NULL, tuning);
+}
+
+// ---------------------------------------------------------------------------
+// Calibration
+// ---------------------------------------------------------------------------
+
+RenderTuning CalibrateRenderTuning(PixelSortDevice* device)
+{
+	double start = PixelSortSeconds();
+	RenderTuning tuning = MakeDefaultTuning();
+	int hardwareThreads = tuning.hardwareThreads;
+	if (device != NULL)
+	{
+		strncpy_s(tuning.deviceName, sizeof(tuning.deviceName), device->GetName(), _TRUNCATE);
+	}
+
+	SourceImage source;
+	MakeCalibrationImage(kCalibrationEngineSide, false, source);
+
+	// Pool size: every hardware thread, or one per core where SMT siblings
+	// only fight over the same caches
+	tuning.threadCount = hardwareThreads;
+	std::unique_ptr<CalibrationRig> rig(new CalibrationRig(hardwareThreads));
+	if (hardwareThreads >= 4)
+	{
+		double all = TimeEngines(*rig, source, tuning, kSortKeyBrightness);
+		std::unique_ptr<CalibrationRig> half(new CalibrationRig(hardwareThreads / 2));
+		double halfTime = TimeEngines(*half, source, tuning, kSortKeyBrightness);
+		PixelSortLog("[PixelSort] Calibrate threads: %d %.1f ms, %d %.1f ms\n",
+			hardwareThreads, all * 1000.0, hardwareThreads / 2, halfTime * 1000.0);
+		if (halfTime < all * kCalibrationMargin)
+		{
+			tuning.threadCount = hardwareThreads / 2;
+			rig.swap(half);
+		}
+	}
+
+	// Intensity codes span 766 values: one counting pass over that many
+	// buckets, or two 8-bit radix passes
+	{
+		RenderTuning radix = tuning;
+		radix.countingSortMaxRange = 256;
+		double counting = TimeEngines(*rig, source, tuning, kSortKeyIntensity);
+		double radixTime = TimeEngines(*rig, source, radix, kSortKeyIntensity);
+		PixelSortLog("[PixelSort] Calibrate intensity sort: counting %.1f ms, radix %.1f ms\n",
+			counting * 1000.0, radixTime * 1000.0);
+		if (radixTime < counting * kCalibrationMargin)
+			tuning.countingSortMaxRange = radix.countingSortMaxRange;
+	}
+
+	// Device threshold per layout and coverage: the smallest canvas from
+	// which the device beat the CPU at every larger calibrated size
+	for (int c = 0; c < kTuningCoverageCount; ++c)
+	{
+		for (int l = 0; l < kTuningLayoutCount; ++l)
+			tuning.deviceSortMinPixels[l][c] = kDeviceSortNever;
+	}
+	if (device != NULL)
+	{
+		RenderTuning onDevice = tuning;
+		bool winning[kTuningLayoutCount][kTuningCoverageCount];
+		for (int l = 0; l < kTuningLayoutCount; ++l)
+		{
+			for (int c = 0; c < kTuningCoverageCount; ++c)
+			{
+				onDevice.deviceSortMinPixels[l][c] = 0.0;
+				winning[l][c] = true;
+			}
+		}
+
+		for (int s = 0; s < kCalibrationSideCount; ++s)
+		{
+			int side = kCalibrationSides[s];
+			double pixels = static_cast<double>(side) * side;
+			bool anyWon = false;
+			for (int c = 0; c < kTuningCoverageCount; ++c)
+			{
+				MakeCalibrationImage(side, c == kTuningCoveragePartial, source);
+				for (int l = 0; l < kTuningLayoutCount; ++l)
+				{
+					// Smaller sizes only matter while the device still wins
+					if (!winning[l][c]) continue;
+
+					PixelSortParams params = CalibrationParams(static_cast<TuningLayout>(l), kSortKeyBrightness);
+					double cpu = rig->Time(source, params, NULL, tuning);
+					double gpu = rig->Time(source, params, device, onDevice);
+					PixelSortLog("[PixelSort] Calibrate %dx%d %s %s: cpu %.1f ms, device %.1f ms\n", side, side,
+						kTuningLayoutNames[l], kTuningCoverageNames[c], cpu * 1000.0, gpu * 1000.0);
+					winning[l][c] = gpu < cpu;
+					if (winning[l][c])
+					{
+						tuning.deviceSortMinPixels[l][c] = pixels;
+						anyWon = true;
+					}
+				}
+			}
+			if (!anyWon) break;
+		}
+	}
+
+	PixelSortLog("[PixelSort] Calibration took %.1f s\n", PixelSortSeconds() - start);
+	return tuning;
+}
+
+// ---------------------------------------------------------------------------
+// Profile file
+// ---------------------------------------------------------------------------
+
+bool TuningMatchesMachine(const RenderTuning& tuning, const PixelSortDevice* device)
+{
+	const char* name = (device != NULL) ? device->GetName() : "";
+	return tuning.hardwareThreads == HardwareThreads() &&
+		strncmp(tuning.deviceName, name, sizeof(tuning.deviceName) - 1) == 0;
+}
+
+// "device_min_pixels.<layout>.<coverage>" names the threshold it returns
+static double* DeviceThresholdField(RenderTuning& tuning, const char* name)
+{
+	static const char prefix[] = "device_min_pixels.";
+	if (strncmp(name, prefix, sizeof(prefix) - 1) != 0) return NULL;
+	name += sizeof(prefix) - 1;
+	for (int l = 0; l < kTuningLayoutCount; ++l)
+	{
+		size_t len = strlen(kTuningLayoutNames[l]);
+		if (strncmp(name, kTuningLayoutNames[l], len) != 0 || name[len] != '.') continue;
+		for (int c = 0; c < kTuningCoverageCount; ++c)
+		{
+			if (strcmp(name + len + 1, kTuningCoverageNames[c]) == 0)
+				return &tuning.deviceSortMinPixels[l][c];
+		}
+	}
+	return NULL;
+}
+
+bool LoadRenderTuning(const char* path, RenderTuning& tuning)
+{
+	FILE* f = NULL;
+	if (fopen_s(&f, path, "r") != 0 || f == NULL) return false;
+
+	RenderTuning loaded = MakeDefaultTuning();
+	loaded.hardwareThreads = 0;
+	int version = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		char* eq = strchr(line, '=');
+		if (line[0] == '#' || eq == NULL) continue;
+		*eq = '\0';
+		const char* name = line;
+		const char* value = eq + 1;
+
+		double* threshold = DeviceThresholdField(loaded, name);
+		if (strcmp(name, "version") == 0)                 version = atoi(value);
+		else if (strcmp(name, "hardware_threads") == 0)   loaded.hardwareThreads = atoi(value);
+		else if (strcmp(name, "threads") == 0)            loaded.threadCount = (std::max)(0, atoi(value));
+		else if (strcmp(name, "counting_max_range") == 0) loaded.countingSortMaxRange = (std::max)(0, atoi(value));
+		else if (strcmp(name, "device") == 0)
+		{
+			strncpy_s(loaded.deviceName, sizeof(loaded.deviceName), value, _TRUNCATE);
+		}
+		else if (threshold != NULL)
+			*threshold = (strcmp(value, "never") == 0) ? kDeviceSortNever : (std::max)(0.0, atof(value));
+	}
+	fclose(f);
+
+	if (version != kRenderTuningVersion) return false;
+	tuning = loaded;
+	return true;
+}
+
+bool SaveRenderTuning(const char* path, const RenderTuning& tuning)
+{
+	FILE* f = NULL;
+	if (fopen_s(&f, path, "w") != 0 || f == NULL) return false;
+	fprintf(f, "# PixelSort tuning profile, measured on this machine.\n");
+	fprintf(f, "# Delete it, or set PIXELSORT_CALIBRATE=1, to measure again.\n");
+	fprintf(f, "version=%d\n", kRenderTuningVersion);
+	fprintf(f, "hardware_threads=%d\n", tuning.hardwareThreads);
+	fprintf(f, "device=%s\n", tuning.deviceName);
+	fprintf(f, "threads=%d\n", tuning.threadCount);
+	fprintf(f, "counting_max_range=%d\n", tuning.countingSortMaxRange);
+	for (int l = 0; l < kTuningLayoutCount; ++l)
+	{
+		for (int c = 0; c < kTuningCoverageCount; ++c)
+		{
+			double pixels = tuning.deviceSortMinPixels[l][c];
+			if (pixels >= kDeviceSortNever)
+				fprintf(f, "device_min_pixels.%s.%s=never\n", kTuningLayoutNames[l], kTuningCoverageNames[c]);
+			else
+				fprintf(f, "device_min_pixels.%s.%s=%.0f\n", kTuningLayoutNames[l], kTuningCoverageNames[c], pixels);
+		}
+	}
+	bool ok = ferror(f) == 0;
+	return fclose(f) == 0 && ok;
+}
+
+void LogRenderTuning(const char* source, const RenderTuning& tuning)
+{
+	// Device thresholds in megapixels, "-" for never
+	char thresholds[kTuningLayoutCount * kTuningCoverageCount][16];
+	for (int l = 0; l < kTuningLayoutCount; ++l)
+	{
+		for (int c = 0; c < kTuningCoverageCount; ++c)
+		{
+			double pixels = tuning.deviceSortMinPixels[l][c];
+			char* out = thresholds[l * kTuningCoverageCount + c];
+			if (pixels >= kDeviceSortNever)
+				strcpy_s(out, sizeof(thresholds[0]), "-");
+			else
+				snprintf(out, sizeof(thresholds[0]), "%.0f", pixels / (1024.0 * 1024.0));
+		}
+	}
+	PixelSortLog("[PixelSort] Tuning (%s): threads=%d counting<=%d device MP h %s/%s v %s/%s a %s/%s\n", source,
+		tuning.threadCount, tuning.countingSortMaxRange,
+		thresholds[0], thresholds[1], thresholds[2], thresholds[3], thresholds[4], thresholds[5]);
+}
@@ -0,0 +1,85 @@
+//! @file   PIRenderTuning.h
+//! @brief  Per-machine choice of render backends, calibrated once and kept in a profile file
+#pragma once
+
+#include "PlugInCommon/PIPixelSort.h"
+
+class PixelSortDevice;
+
+// Bumped when the profile's fields or the calibration change, so profiles
+// written by older builds are measured again
+static const int kRenderTuningVersion = 1;
+
+// ---------------------------------------------------------------------------
+// Tuning
+// ---------------------------------------------------------------------------
+
+// Pass shapes the device threshold is kept for
+enum TuningLayout
+{
+	kTuningLayoutHorizontal = 0,
+	kTuningLayoutVertical   = 1,
+	kTuningLayoutAngle      = 2,
+	kTuningLayoutCount      = 3
+};
+
+enum TuningCoverage
+{
+	kTuningCoverageFull    = 0, // no selection
+	kTuningCoveragePartial = 1, // the pass blends through a selection
+	kTuningCoverageCount   = 2
+};
+
+// A threshold no pass reaches: the device never won at any calibrated size
+static const double kDeviceSortNever = 1.0e18;
+
+// Which engine each pass uses on this machine. The defaults are the
+// built-in heuristics, used until a profile is read or calibrated.
+struct RenderTuning
+{
+	int    threadCount;          // workers of the plug-in's pool; 0: one per hardware thread
+	int    countingSortMaxRange; // key ranges up to this use a counting pass, larger ones radix
+	double deviceSortMinPixels[kTuningLayoutCount][kTuningCoverageCount]; // see DeviceSortMinPixels
+
+	// The machine the profile was measured on; a profile for another one
+	// is calibrated again
+	int    hardwareThreads;
+	char   deviceName[128];      // "" if there was no sort device
+};
+
+RenderTuning MakeDefaultTuning();
+
+inline TuningLayout TuningLayoutOf(const PixelSortParams& params)
+{
+	if (ParamsUseColumns(params)) return kTuningLayoutVertical;
+	return ParamsUseAngle(params) ? kTuningLayoutAngle : kTuningLayoutHorizontal;
+}
+
+// Passes of this many pixels or more sort on the device, if there is one
+inline double DeviceSortMinPixels(const RenderTuning& tuning, const PixelSortParams& params, bool hasSelection)
+{
+	return tuning.deviceSortMinPixels[TuningLayoutOf(params)][hasSelection ? kTuningCoveragePartial : kTuningCoverageFull];
+}
+
+// ---------------------------------------------------------------------------
+// Calibration and profile
+// ---------------------------------------------------------------------------
+
+// Times the candidate engines on synthetic images: pool sizes, counting vs
+// radix sort for mid-range keys, and CPU vs `device` (may be NULL) at a
+// few canvas sizes for every layout and coverage. Takes a few seconds with
+// a device, well under one without.
+RenderTuning CalibrateRenderTuning(PixelSortDevice* device);
+
+// Reads `path`; false (and `tuning` untouched) if it is missing, of another
+// version or unreadable
+bool LoadRenderTuning(const char* path, RenderTuning& tuning);
+
+// Writes `tuning` to `path` as "name=value" lines; false if it cannot
+bool SaveRenderTuning(const char* path, const RenderTuning& tuning);
+
+// Whether a profile was measured on this machine with this sort device
+bool TuningMatchesMachine(const RenderTuning& tuning, const PixelSortDevice* device);
+
+// One summary line per profile
+void LogRenderTuning(const char* source, const RenderTuning& tuning);
@@ -0,0 +1,63 @@
+//! @file   PISyntheticImage.h
+//! @brief  Reproducible test canvases for the benchmark and the engine calibration
+#pragma once
+
+#include "PlugInCommon/PIPixelSort.h"
+#include <cmath>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Synthetic canvases
+// ---------------------------------------------------------------------------
+
+// Integer hash for reproducible noise
+inline unsigned int SyntheticHash(unsigned int x)
+{
+	x ^= x >> 16; x *= 0x7FEB352DU;
+	x ^= x >> 15; x *= 0x846CA68BU;
+	x ^= x >> 16;
+	return x;
+}
+
+// Gradients with noise and bright stripes, so every interval mode finds a
+// mix of short and long spans
+inline void MakeSyntheticImage(int w, int h, std::vector<BYTE>& image)
+{
+	image.resize(static_cast<size_t>(w) * h * 3);
+	for (int y = 0; y < h; ++y)
+	{
+		BYTE* p = image.data() + static_cast<size_t>(y) * w * 3;
+		for (int x = 0; x < w; ++x, p += 3)
+		{
+			unsigned int n = SyntheticHash(static_cast<unsigned int>(y) * 0x9E3779B1U + static_cast<unsigned int>(x));
+			int stripe = (((x + y / 2) / 97) % 3 == 0) ? 96 : 0;
+			int noise = static_cast<int>(n & 63) - 32;
+			int r = static_cast<int>(static_cast<long long>(x) * 255 / (w > 1 ? w - 1 : 1)) + noise;
+			int g = static_cast<int>(static_cast<long long>(y) * 255 / (h > 1 ? h - 1 : 1)) + stripe;
+			int b = static_cast<int>((n >> 8) & 255) / 2 + stripe;
+			p[0] = static_cast<BYTE>((std::max)(0, (std::min)(255, r)));
+			p[1] = static_cast<BYTE>((std::max)(0, (std::min)(255, g)));
+			p[2] = static_cast<BYTE>((std::max)(0, (std::min)(255, b)));
+		}
+	}
+}
+
+// Fully selected inside 70% of the inscribed ellipse, fading to unselected
+// at its edge
+inline void MakeEllipseSelection(int w, int h, std::vector<BYTE>& select)
+{
+	select.resize(static_cast<size_t>(w) * h);
+	double cx = 0.5 * w, cy = 0.5 * h;
+	for (int y = 0; y < h; ++y)
+	{
+		double dy = (y + 0.5 - cy) / cy;
+		BYTE* row = select.data() + static_cast<size_t>(y) * w;
+		for (int x = 0; x < w; ++x)
+		{
+			double dx = (x + 0.5 - cx) / cx;
+			double d = sqrt(dx * dx + dy * dy);
+			double a = (d <= 0.7) ? 1.0 : (d >= 1.0 ? 0.0 : (1.0 - d) / 0.3);
+			row[x] = static_cast<BYTE>(a * 255.0 + 0.5);
+		}
+	}
+}
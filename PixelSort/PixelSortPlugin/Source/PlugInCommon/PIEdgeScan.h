@@ -0,0 +1,266 @@
+//! @file   PIEdgeScan.h
+//! @brief  Edges mode gradient statistics and split scan, with CPUID dispatch
+#pragma once
+
+#include "PIPixelSort.h"
+#include "PIKeySIMD.h"
+
+// The gradient of a line of brightness codes is |b[i + 1] - b[i]|. Edges
+// mode splits the line wherever the gradient exceeds mean + stddev of the
+// gradient, taken over the line or over the whole image. Neither pass stores
+// the gradient: the statistics are integer sums, and the split scan
+// recomputes differences on the fly.
+
+// ---------------------------------------------------------------------------
+// Gradient statistics
+// ---------------------------------------------------------------------------
+
+// Exact integer sums (codes are below 65536, so a line of 2^24 pixels stays
+// far inside 64 bits); they add across lines in any order
+struct EdgeStats
+{
+	unsigned long long sum;
+	unsigned long long sumSq;
+	unsigned long long count;
+};
+
+inline EdgeStats MakeEdgeStats()
+{
+	EdgeStats s = { 0, 0, 0 };
+	return s;
+}
+
+inline void AddEdgeStats(EdgeStats& a, const EdgeStats& b)
+{
+	a.sum += b.sum;
+	a.sumSq += b.sumSq;
+	a.count += b.count;
+}
+
+// Largest gradient that does not split: the gradient is an integer, so
+// "e > mean + stddev" is "e > floor(mean + stddev)". The double math is the
+// same as summing the gradient in doubles, since the sums are exact.
+inline int EdgeSplitLimit(const EdgeStats& s)
+{
+	if (s.count == 0) return 65535;
+	double mean = static_cast<double>(s.sum) / s.count;
+	double variance = (static_cast<double>(s.sumSq) / s.count) - (mean * mean);
+	if (variance < 0.0) variance = 0.0;
+	double threshold = mean + sqrt(variance);
+	if (threshold >= 65535.0) return 65535;
+	return static_cast<int>(floor(threshold));
+}
+
+// ---------------------------------------------------------------------------
+// Scalar reference
+// ---------------------------------------------------------------------------
+
+// Adds the n - 1 gradients of n codes to `s`
+inline void AccumulateEdgeStats(const unsigned short* codes, int n, EdgeStats& s)
+{
+	if (n < 2) return;
+	unsigned long long sum = 0, sumSq = 0;
+	for (int i = 0; i + 1 < n; ++i)
+	{
+		unsigned int e = (codes[i + 1] > codes[i]) ? codes[i + 1] - codes[i] : codes[i] - codes[i + 1];
+		sum += e;
+		sumSq += static_cast<unsigned long long>(e) * e;
+	}
+	s.sum += sum;
+	s.sumSq += sumSq;
+	s.count += n - 1;
+}
+
+// First gradient index in [from, n - 1) above `limit`, or n - 1 if none
+inline int FindEdgeSplit(const unsigned short* codes, int from, int n, int limit)
+{
+	for (int i = from; i + 1 < n; ++i)
+	{
+		int e = (codes[i + 1] > codes[i]) ? codes[i + 1] - codes[i] : codes[i] - codes[i + 1];
+		if (e > limit) return i;
+	}
+	return (std::max)(from, n - 1);
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.1 kernels (8 gradients per step)
+// ---------------------------------------------------------------------------
+
+#if PIXELSORT_HAS_X86_SIMD
+
+// Gradient sums stay exact in 32-bit lanes for this many steps (2 * 65535
+// per lane per step)
+static const int kEdgeStatsBlockSteps = 16384;
+
+PIXELSORT_TARGET_SSE41
+inline __m128i EdgeGradient8(const unsigned short* p)
+{
+	__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+	return _mm_sub_epi16(_mm_max_epu16(a, b), _mm_min_epu16(a, b));
+}
+
+PIXELSORT_TARGET_SSE41
+inline void AccumulateEdgeStats_SSE41(const unsigned short* codes, int n, EdgeStats& s)
+{
+	if (n < 2) return;
+	__m128i zero = _mm_setzero_si128();
+	unsigned long long sum = 0;
+	__m128i sq64 = zero;
+
+	// Step i reads codes[i, i + 9)
+	int i = 0;
+	while (i + 9 <= n)
+	{
+		__m128i sum32 = zero;
+		for (int step = 0; step < kEdgeStatsBlockSteps && i + 9 <= n; ++step, i += 8)
+		{
+			__m128i e = EdgeGradient8(codes + i);
+			__m128i lo = _mm_unpacklo_epi16(e, zero);
+			__m128i hi = _mm_unpackhi_epi16(e, zero);
+			sum32 = _mm_add_epi32(sum32, _mm_add_epi32(lo, hi));
+
+			// e * e < 2^32: the products are exact as unsigned 32-bit lanes
+			__m128i sqLo = _mm_mullo_epi32(lo, lo);
+			__m128i sqHi = _mm_mullo_epi32(hi, hi);
+			sq64 = _mm_add_epi64(sq64, _mm_add_epi64(_mm_unpacklo_epi32(sqLo, zero), _mm_unpackhi_epi32(sqLo, zero)));
+			sq64 = _mm_add_epi64(sq64, _mm_add_epi64(_mm_unpacklo_epi32(sqHi, zero), _mm_unpackhi_epi32(sqHi, zero)));
+		}
+		alignas(16) unsigned int lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), sum32);
+		sum += static_cast<unsigned long long>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+	}
+	alignas(16) unsigned long long sq[2];
+	_mm_store_si128(reinterpret_cast<__m128i*>(sq), sq64);
+
+	s.sum += sum;
+	s.sumSq += sq[0] + sq[1];
+	s.count += i;
+	AccumulateEdgeStats(codes + i, n - i, s);
+}
+
+PIXELSORT_TARGET_SSE41
+inline int FindEdgeSplit_SSE41(const unsigned short* codes, int from, int n, int limit)
+{
+	if (limit >= 65535) return (std::max)(from, n - 1);
+	__m128i above = _mm_set1_epi16(static_cast<short>(limit + 1));
+	int i = from;
+	for (; i + 9 <= n; i += 8)
+	{
+		__m128i e = EdgeGradient8(codes + i);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_max_epu16(e, above), e)) != 0)
+			break;
+	}
+	return FindEdgeSplit(codes, i, n, limit);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels (16 gradients per step)
+// ---------------------------------------------------------------------------
+
+PIXELSORT_TARGET_AVX2
+inline __m256i EdgeGradient16(const unsigned short* p)
+{
+	__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+	__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+	return _mm256_sub_epi16(_mm256_max_epu16(a, b), _mm256_min_epu16(a, b));
+}
+
+PIXELSORT_TARGET_AVX2
+inline void AccumulateEdgeStats_AVX2(const unsigned short* codes, int n, EdgeStats& s)
+{
+	if (n < 2) return;
+	__m256i zero = _mm256_setzero_si256();
+	unsigned long long sum = 0;
+	__m256i sq64 = zero;
+
+	// Step i reads codes[i, i + 17); unpacks work per 128-bit lane, which
+	// only reorders the sums
+	int i = 0;
+	while (i + 17 <= n)
+	{
+		__m256i sum32 = zero;
+		for (int step = 0; step < kEdgeStatsBlockSteps && i + 17 <= n; ++step, i += 16)
+		{
+			__m256i e = EdgeGradient16(codes + i);
+			__m256i lo = _mm256_unpacklo_epi16(e, zero);
+			__m256i hi = _mm256_unpackhi_epi16(e, zero);
+			sum32 = _mm256_add_epi32(sum32, _mm256_add_epi32(lo, hi));
+
+			__m256i sqLo = _mm256_mullo_epi32(lo, lo);
+			__m256i sqHi = _mm256_mullo_epi32(hi, hi);
+			sq64 = _mm256_add_epi64(sq64, _mm256_add_epi64(_mm256_unpacklo_epi32(sqLo, zero), _mm256_unpackhi_epi32(sqLo, zero)));
+			sq64 = _mm256_add_epi64(sq64, _mm256_add_epi64(_mm256_unpacklo_epi32(sqHi, zero), _mm256_unpackhi_epi32(sqHi, zero)));
+		}
+		alignas(32) unsigned int lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sum32);
+		for (int k = 0; k < 8; ++k)
+			sum += lanes[k];
+	}
+	alignas(32) unsigned long long sq[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(sq), sq64);
+
+	s.sum += sum;
+	s.sumSq += sq[0] + sq[1] + sq[2] + sq[3];
+	s.count += i;
+	AccumulateEdgeStats(codes + i, n - i, s);
+}
+
+PIXELSORT_TARGET_AVX2
+inline int FindEdgeSplit_AVX2(const unsigned short* codes, int from, int n, int limit)
+{
+	if (limit >= 65535) return (std::max)(from, n - 1);
+	__m256i above = _mm256_set1_epi16(static_cast<short>(limit + 1));
+	int i = from;
+	for (; i + 17 <= n; i += 16)
+	{
+		__m256i e = EdgeGradient16(codes + i);
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_max_epu16(e, above), e)) != 0)
+			break;
+	}
+	return FindEdgeSplit(codes, i, n, limit);
+}
+
+#endif // PIXELSORT_HAS_X86_SIMD
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+typedef void (*AccumulateEdgeStatsFunc)(const unsigned short* codes, int n, EdgeStats& s);
+typedef int  (*FindEdgeSplitFunc)(const unsigned short* codes, int from, int n, int limit);
+
+struct EdgeKernel
+{
+	AccumulateEdgeStatsFunc accumulate;
+	FindEdgeSplitFunc       findSplit;
+	const char*             name;
+};
+
+inline EdgeKernel SelectEdgeKernel()
+{
+	EdgeKernel k = { AccumulateEdgeStats, FindEdgeSplit, "scalar" };
+#if PIXELSORT_HAS_X86_SIMD
+	CpuFeatures f = DetectCpuFeatures();
+	if (f.avx2)
+	{
+		k.accumulate = AccumulateEdgeStats_AVX2;
+		k.findSplit = FindEdgeSplit_AVX2;
+		k.name = "AVX2";
+	}
+	else if (f.sse41)
+	{
+		k.accumulate = AccumulateEdgeStats_SSE41;
+		k.findSplit = FindEdgeSplit_SSE41;
+		k.name = "SSE4.1";
+	}
+#endif
+	return k;
+}
+
+// Kernel for this CPU, chosen by CPUID on first use (ModuleInitialize)
+inline const EdgeKernel& GetEdgeKernel()
+{
+	static const EdgeKernel kernel = SelectEdgeKernel();
+	return kernel;
+}
@@ -0,0 +1,115 @@
+//! @file   PIKeyPlane.h
+//! @brief  Precomputed per-pixel sort key codes shared by span detection and sorting
+#pragma once
+
+#include "PIPixelSort.h"
+#include "PIKeySIMD.h"
+
+// ---------------------------------------------------------------------------
+// Key line - one row of a key plane, or a traced line
+// ---------------------------------------------------------------------------
+
+struct KeyLine
+{
+	const unsigned short* base;
+	int                   stride; // in elements
+	int                   length;
+
+	unsigned short at(int i) const
+	{
+		return base[i * stride];
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Key plane
+// ---------------------------------------------------------------------------
+
+// Key codes for every pixel of a packed RGB image, plus brightness codes when
+// Edges mode needs them and the sort key is not already Brightness. Vertical
+// passes store it transposed, one image column per row. For
+// traced lines the codes are also gathered into line order (lineKeys).
+struct KeyPlane
+{
+	std::vector<unsigned short> keys;
+	std::vector<unsigned short> brightness;
+	std::vector<unsigned short> lineKeys;       // keys in traced-line order
+	std::vector<unsigned short> lineBrightness; // brightness in traced-line order
+	int                         width;
+	int                         height;
+	bool                        hasBrightness; // separate brightness plane (Edges mode only)
+
+	void Allocate(int w, int h, SortKey key, IntervalMode mode)
+	{
+		width = w;
+		height = h;
+		keys.resize(static_cast<size_t>(w) * h);
+		hasBrightness = (mode == kIntervalModeEdges && key != kSortKeyBrightness);
+		if (hasBrightness)
+			brightness.resize(static_cast<size_t>(w) * h);
+	}
+
+	// Line-order buffers for traced lines; call after Allocate
+	void AllocateLines()
+	{
+		lineKeys.resize(keys.size());
+		if (hasBrightness)
+			lineBrightness.resize(keys.size());
+	}
+
+	// Copy the codes of pixels[begin, end) into line order. Call after the
+	// rows those pixels fall in have been built.
+	void GatherLines(const int* pixels, size_t begin, size_t end)
+	{
+		for (size_t j = begin; j < end; ++j)
+			lineKeys[j] = keys[pixels[j]];
+		if (hasBrightness)
+			for (size_t j = begin; j < end; ++j)
+				lineBrightness[j] = brightness[pixels[j]];
+	}
+
+	// Fill rows [yBegin, yEnd) from a packed RGB image of the same size
+	void BuildRows(const BYTE* rgb, SortKey key, int yBegin, int yEnd)
+	{
+		for (int y = yBegin; y < yEnd; ++y)
+			BuildRow(rgb + static_cast<size_t>(y) * width * 3, key, y);
+	}
+
+	// Fill row y from `width` packed RGB pixels
+	void BuildRow(const BYTE* rgbRow, SortKey key, int y)
+	{
+		KeyCodesRGBFunc computeRGB = GetKeyKernel().computeRGB;
+		size_t offset = static_cast<size_t>(y) * width;
+		computeRGB(rgbRow, width, key, keys.data() + offset);
+		if (hasBrightness)
+			computeRGB(rgbRow, width, kSortKeyBrightness, brightness.data() + offset);
+	}
+
+	KeyLine Row(int y) const
+	{
+		KeyLine line = { keys.data() + static_cast<size_t>(y) * width, 1, width };
+		return line;
+	}
+
+	// Brightness codes for the same line (the key line itself when sorting by Brightness)
+	KeyLine BrightnessRow(int y) const
+	{
+		if (!hasBrightness) return Row(y);
+		KeyLine line = { brightness.data() + static_cast<size_t>(y) * width, 1, width };
+		return line;
+	}
+
+	// Gathered codes of a traced line starting at `begin` in line order
+	KeyLine Line(int begin, int length) const
+	{
+		KeyLine line = { lineKeys.data() + begin, 1, length };
+		return line;
+	}
+
+	KeyLine BrightnessLine(int begin, int length) const
+	{
+		if (!hasBrightness) return Line(begin, length);
+		KeyLine line = { lineBrightness.data() + begin, 1, length };
+		return line;
+	}
+};
@@ -0,0 +1,352 @@
+//! @file   PIKeySIMD.h
+//! @brief  SSE4.1 / AVX2 batch sort key kernels with CPUID dispatch
+#pragma once
+
+#include "PIPixelSort.h"
+
+// Vector kernels produce exactly the same codes as the scalar reference
+// ComputeKeyCodesRGB (same float operations as GetSortKeyCode in the same
+// order, no FMA). Hue and Saturation stay in float here: on SSE4.1 and
+// AVX2 the vector division beats the scalar table lookups, and gathers
+// from the tables are no faster.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELSORT_HAS_X86_SIMD 1
+#else
+#define PIXELSORT_HAS_X86_SIMD 0
+#endif
+
+#if PIXELSORT_HAS_X86_SIMD
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PIXELSORT_TARGET_SSE41
+#define PIXELSORT_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define PIXELSORT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define PIXELSORT_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+// ---------------------------------------------------------------------------
+// CPU feature detection
+// ---------------------------------------------------------------------------
+
+struct CpuFeatures
+{
+	bool sse41;
+	bool avx2;
+};
+
+inline void PixelSortCpuid(int leaf, int subleaf, int regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex(regs, leaf, subleaf);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = static_cast<int>(a); regs[1] = static_cast<int>(b);
+	regs[2] = static_cast<int>(c); regs[3] = static_cast<int>(d);
+#endif
+}
+
+inline unsigned long long PixelSortXgetbv()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+inline CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures f = { false, false };
+	int regs[4];
+	PixelSortCpuid(0, 0, regs);
+	int maxLeaf = regs[0];
+	if (maxLeaf < 1) return f;
+
+	PixelSortCpuid(1, 0, regs);
+	f.sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx     = (regs[2] & (1 << 28)) != 0;
+
+	// AVX2 also needs the OS to save YMM state (XCR0 bits 1 and 2)
+	if (maxLeaf >= 7 && osxsave && avx && (PixelSortXgetbv() & 0x6) == 0x6)
+	{
+		PixelSortCpuid(7, 0, regs);
+		f.avx2 = (regs[1] & (1 << 5)) != 0;
+	}
+	return f;
+}
+
+// ---------------------------------------------------------------------------
+// Shared helpers
+// ---------------------------------------------------------------------------
+
+// Split 16 packed RGB pixels (48 bytes) into 16 R, 16 G and 16 B bytes
+PIXELSORT_TARGET_SSE41
+inline void DeinterleaveRGB16(const BYTE* rgb, __m128i& r, __m128i& g, __m128i& b)
+{
+	__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb));
+	__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 16));
+	__m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 32));
+
+	r = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+	g = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+	b = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// Integer keys (Red, Green, Blue, Minimum, Intensity) for 16 pixels
+PIXELSORT_TARGET_SSE41
+inline void IntegerKeyCodes16(__m128i r, __m128i g, __m128i b, SortKey key, unsigned short* out)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+	switch (key)
+	{
+	case kSortKeyRed:
+		lo = _mm_unpacklo_epi8(r, zero); hi = _mm_unpackhi_epi8(r, zero);
+		break;
+	case kSortKeyGreen:
+		lo = _mm_unpacklo_epi8(g, zero); hi = _mm_unpackhi_epi8(g, zero);
+		break;
+	case kSortKeyBlue:
+		lo = _mm_unpacklo_epi8(b, zero); hi = _mm_unpackhi_epi8(b, zero);
+		break;
+	case kSortKeyMinimum:
+	{
+		__m128i m = _mm_min_epu8(_mm_min_epu8(r, g), b);
+		lo = _mm_unpacklo_epi8(m, zero); hi = _mm_unpackhi_epi8(m, zero);
+		break;
+	}
+	case kSortKeyIntensity:
+	default:
+		lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero)), _mm_unpacklo_epi8(b, zero));
+		hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero)), _mm_unpackhi_epi8(b, zero));
+		break;
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), lo);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), hi);
+}
+
+inline bool IsFloatSortKey(SortKey key)
+{
+	return key == kSortKeyBrightness || key == kSortKeyHue || key == kSortKeySaturation;
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.1 kernel (4 float lanes)
+// ---------------------------------------------------------------------------
+
+// Float keys for 4 pixels, mirroring GetSortKeyCode / GetHue / GetSaturation
+PIXELSORT_TARGET_SSE41
+inline __m128i FloatKeyCodes4_SSE41(__m128 r, __m128 g, __m128 b, SortKey key)
+{
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 zero = _mm_setzero_ps();
+
+	if (key == kSortKeyBrightness)
+	{
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.299f), r), _mm_mul_ps(_mm_set1_ps(0.587f), g)),
+			_mm_mul_ps(_mm_set1_ps(0.114f), b));
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(256.0f)), half));
+	}
+
+	__m128 maxC = _mm_max_ps(_mm_max_ps(r, g), b);
+	__m128 minC = _mm_min_ps(_mm_min_ps(r, g), b);
+
+	if (key == kSortKeySaturation)
+	{
+		__m128 valid = _mm_cmpgt_ps(maxC, zero);
+		__m128 s = _mm_div_ps(_mm_sub_ps(maxC, minC), _mm_max_ps(maxC, _mm_set1_ps(1.0f)));
+		s = _mm_and_ps(s, valid);
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(65535.0f)), half));
+	}
+
+	// Hue
+	__m128 delta = _mm_sub_ps(maxC, minC);
+	__m128 valid = _mm_cmpgt_ps(delta, zero);
+	__m128 d = _mm_max_ps(delta, _mm_set1_ps(1.0f));
+	__m128 sixty = _mm_set1_ps(60.0f);
+
+	// |(g - b) / delta| <= 1, so fmodf(x, 6) == x in the red branch
+	__m128 hr = _mm_mul_ps(sixty, _mm_div_ps(_mm_sub_ps(g, b), d));
+	__m128 hg = _mm_mul_ps(sixty, _mm_add_ps(_mm_div_ps(_mm_sub_ps(b, r), d), _mm_set1_ps(2.0f)));
+	__m128 hb = _mm_mul_ps(sixty, _mm_add_ps(_mm_div_ps(_mm_sub_ps(r, g), d), _mm_set1_ps(4.0f)));
+
+	__m128 isR = _mm_cmpeq_ps(maxC, r);
+	__m128 isG = _mm_cmpeq_ps(maxC, g);
+	__m128 hue = _mm_blendv_ps(_mm_blendv_ps(hb, hg, isG), hr, isR);
+	hue = _mm_add_ps(hue, _mm_and_ps(_mm_cmplt_ps(hue, zero), _mm_set1_ps(360.0f)));
+	hue = _mm_and_ps(hue, valid);
+
+	__m128 code = _mm_min_ps(_mm_set1_ps(65535.0f), _mm_add_ps(_mm_mul_ps(hue, _mm_set1_ps(65535.0f / 360.0f)), half));
+	return _mm_cvttps_epi32(code);
+}
+
+PIXELSORT_TARGET_SSE41
+inline void ComputeKeyCodesRGB_SSE41(const BYTE* rgb, int n, SortKey key, unsigned short* out)
+{
+	bool floatKey = IsFloatSortKey(key);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i r8, g8, b8;
+		DeinterleaveRGB16(rgb + i * 3, r8, g8, b8);
+		if (!floatKey)
+		{
+			IntegerKeyCodes16(r8, g8, b8, key, out + i);
+			continue;
+		}
+
+		__m128i c[4];
+		for (int q = 0; q < 4; ++q)
+		{
+			__m128 r = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(r8));
+			__m128 g = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(g8));
+			__m128 b = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(b8));
+			c[q] = FloatKeyCodes4_SSE41(r, g, b, key);
+			r8 = _mm_srli_si128(r8, 4);
+			g8 = _mm_srli_si128(g8, 4);
+			b8 = _mm_srli_si128(b8, 4);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi32(c[0], c[1]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_packus_epi32(c[2], c[3]));
+	}
+	if (i < n)
+		ComputeKeyCodesRGB(rgb + i * 3, n - i, key, out + i);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernel (8 float lanes)
+// ---------------------------------------------------------------------------
+
+PIXELSORT_TARGET_AVX2
+inline __m256i FloatKeyCodes8_AVX2(__m256 r, __m256 g, __m256 b, SortKey key)
+{
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256 zero = _mm256_setzero_ps();
+
+	if (key == kSortKeyBrightness)
+	{
+		__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.299f), r), _mm256_mul_ps(_mm256_set1_ps(0.587f), g)),
+			_mm256_mul_ps(_mm256_set1_ps(0.114f), b));
+		return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(256.0f)), half));
+	}
+
+	__m256 maxC = _mm256_max_ps(_mm256_max_ps(r, g), b);
+	__m256 minC = _mm256_min_ps(_mm256_min_ps(r, g), b);
+
+	if (key == kSortKeySaturation)
+	{
+		__m256 valid = _mm256_cmp_ps(maxC, zero, _CMP_GT_OQ);
+		__m256 s = _mm256_div_ps(_mm256_sub_ps(maxC, minC), _mm256_max_ps(maxC, _mm256_set1_ps(1.0f)));
+		s = _mm256_and_ps(s, valid);
+		return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(s, _mm256_set1_ps(65535.0f)), half));
+	}
+
+	__m256 delta = _mm256_sub_ps(maxC, minC);
+	__m256 valid = _mm256_cmp_ps(delta, zero, _CMP_GT_OQ);
+	__m256 d = _mm256_max_ps(delta, _mm256_set1_ps(1.0f));
+	__m256 sixty = _mm256_set1_ps(60.0f);
+
+	__m256 hr = _mm256_mul_ps(sixty, _mm256_div_ps(_mm256_sub_ps(g, b), d));
+	__m256 hg = _mm256_mul_ps(sixty, _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(b, r), d), _mm256_set1_ps(2.0f)));
+	__m256 hb = _mm256_mul_ps(sixty, _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(r, g), d), _mm256_set1_ps(4.0f)));
+
+	__m256 isR = _mm256_cmp_ps(maxC, r, _CMP_EQ_OQ);
+	__m256 isG = _mm256_cmp_ps(maxC, g, _CMP_EQ_OQ);
+	__m256 hue = _mm256_blendv_ps(_mm256_blendv_ps(hb, hg, isG), hr, isR);
+	hue = _mm256_add_ps(hue, _mm256_and_ps(_mm256_cmp_ps(hue, zero, _CMP_LT_OQ), _mm256_set1_ps(360.0f)));
+	hue = _mm256_and_ps(hue, valid);
+
+	__m256 code = _mm256_min_ps(_mm256_set1_ps(65535.0f),
+		_mm256_add_ps(_mm256_mul_ps(hue, _mm256_set1_ps(65535.0f / 360.0f)), half));
+	return _mm256_cvttps_epi32(code);
+}
+
+PIXELSORT_TARGET_AVX2
+inline void ComputeKeyCodesRGB_AVX2(const BYTE* rgb, int n, SortKey key, unsigned short* out)
+{
+	bool floatKey = IsFloatSortKey(key);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i r8, g8, b8;
+		DeinterleaveRGB16(rgb + i * 3, r8, g8, b8);
+		if (!floatKey)
+		{
+			IntegerKeyCodes16(r8, g8, b8, key, out + i);
+			continue;
+		}
+
+		__m256i lo = FloatKeyCodes8_AVX2(
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(r8)),
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(g8)),
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b8)), key);
+		__m256i hi = FloatKeyCodes8_AVX2(
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(r8, 8))),
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(g8, 8))),
+			_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b8, 8))), key);
+
+		// packus works per 128-bit lane; restore pixel order afterwards
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+	}
+	if (i < n)
+		ComputeKeyCodesRGB(rgb + i * 3, n - i, key, out + i);
+}
+
+#endif // PIXELSORT_HAS_X86_SIMD
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+typedef void (*KeyCodesRGBFunc)(const BYTE* rgb, int n, SortKey key, unsigned short* out);
+
+struct KeyKernel
+{
+	KeyCodesRGBFunc computeRGB;
+	const char*     name;
+};
+
+inline KeyKernel SelectKeyKernel()
+{
+	KeyKernel k = { ComputeKeyCodesRGB, "scalar" };
+#if PIXELSORT_HAS_X86_SIMD
+	CpuFeatures f = DetectCpuFeatures();
+	if (f.avx2)
+	{
+		k.computeRGB = ComputeKeyCodesRGB_AVX2;
+		k.name = "AVX2";
+	}
+	else if (f.sse41)
+	{
+		k.computeRGB = ComputeKeyCodesRGB_SSE41;
+		k.name = "SSE4.1";
+	}
+#endif
+	return k;
+}
+
+// Kernel for this CPU, chosen by CPUID on first use (ModuleInitialize)
+inline const KeyKernel& GetKeyKernel()
+{
+	static const KeyKernel kernel = SelectKeyKernel();
+	return kernel;
+}
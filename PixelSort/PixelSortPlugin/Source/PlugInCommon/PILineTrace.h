@@ -0,0 +1,121 @@
+//! @file   PILineTrace.h
+//! @brief  Parallel digital lines at an angle, covering every pixel exactly once
+#pragma once
+
+#include "PIPixelSort.h"
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ---------------------------------------------------------------------------
+// Line layout
+// ---------------------------------------------------------------------------
+
+// The image is cut into parallel DDA lines running in direction
+// (cos angle, sin angle). For an x-major angle every line takes one pixel
+// per column, at y = k + round(x * tan angle); shifting k by one moves the
+// line down one row, so each pixel lies on exactly one line. y-major angles
+// swap the roles of x and y. Pixels of a line are stored in traversal order.
+struct LineLayout
+{
+	std::vector<int> offsets; // lineCount + 1 entries into `pixels`
+	std::vector<int> pixels;  // pixel index (y * width + x), line by line
+	int              width;
+	int              height;
+	bool             xMajor;  // one pixel per column (else one per row)
+	int              minOff;  // range of the per-column (per-row) offset
+	int              maxOff;
+
+	// Build scratch, kept for the next Build
+	std::vector<int> stepOffsets; // minor offset at each major step
+	std::vector<int> fillWork;    // next free slot of each line
+
+	LineLayout() : width(0), height(0), xMajor(true), minOff(0), maxOff(0) {}
+
+	// No lines; the buffers keep their capacity
+	void Clear()
+	{
+		offsets.clear();
+		pixels.clear();
+		width = height = 0;
+		xMajor = true;
+		minOff = maxOff = 0;
+	}
+
+	int LineCount() const
+	{
+		return static_cast<int>(offsets.size()) - 1;
+	}
+
+	int LineLength(int line) const
+	{
+		return offsets[line + 1] - offsets[line];
+	}
+
+	const int* LinePixels(int line) const
+	{
+		return pixels.data() + offsets[line];
+	}
+
+	// Lines cross rows (x-major) or columns (y-major) in order, so once lines
+	// [0, linesDone) are sorted a prefix of those rows/columns is final.
+	// Returns the length of that prefix.
+	int UnitsComplete(int linesDone) const
+	{
+		int units = xMajor ? height : width;
+		int ready = linesDone + minOff - maxOff;
+		return (std::max)(0, (std::min)(units, ready));
+	}
+
+	void Build(int w, int h, int angle)
+	{
+		width = w;
+		height = h;
+		double rad = angle * M_PI / 180.0;
+		double c = cos(rad), s = sin(rad);
+		xMajor = fabs(c) >= fabs(s);
+
+		// Steps along the major axis, in traversal order, and the offset of
+		// the minor coordinate at each step
+		int majorCount = xMajor ? w : h;
+		int minorCount = xMajor ? h : w;
+		double slope = xMajor ? s / c : c / s;
+		bool descending = xMajor ? (c < 0) : (s < 0);
+
+		std::vector<int>& off = stepOffsets;
+		off.resize(majorCount);
+		for (int m = 0; m < majorCount; ++m)
+			off[m] = static_cast<int>(floor(m * slope + 0.5));
+		minOff = (std::min)(off.front(), off.back());
+		maxOff = (std::max)(off.front(), off.back());
+
+		// Line index of (major m, minor n) is n - off[m] + maxOff
+		int lineCount = minorCount + maxOff - minOff;
+		offsets.assign(lineCount + 1, 0);
+		for (int m = 0; m < majorCount; ++m)
+		{
+			int first = maxOff - off[m];
+			for (int n = 0; n < minorCount; ++n)
+				++offsets[first + n + 1];
+		}
+		for (int k = 0; k < lineCount; ++k)
+			offsets[k + 1] += offsets[k];
+
+		pixels.resize(static_cast<size_t>(w) * h);
+		std::vector<int>& fill = fillWork;
+		fill.assign(offsets.begin(), offsets.end() - 1);
+		for (int step = 0; step < majorCount; ++step)
+		{
+			int m = descending ? majorCount - 1 - step : step;
+			int first = maxOff - off[m];
+			for (int n = 0; n < minorCount; ++n)
+			{
+				int x = xMajor ? m : n;
+				int y = xMajor ? n : m;
+				pixels[fill[first + n]++] = y * w + x;
+			}
+		}
+	}
+};
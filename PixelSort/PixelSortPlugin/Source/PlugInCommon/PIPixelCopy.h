@@ -0,0 +1,356 @@
+//! @file   PIPixelCopy.h
+//! @brief  Row copies between host pixel layouts and packed RGB, and the
+//!         selection blend, with CPUID dispatch
+#pragma once
+
+#include "PIPixelSort.h"
+#include "PIKeySIMD.h"
+#include <cstring>
+
+// ---------------------------------------------------------------------------
+// Pixel layout
+// ---------------------------------------------------------------------------
+
+// Interleaved host pixels: pixelBytes per pixel, with R, G and B at the
+// given byte offsets (e.g. BGRA blocks are { 4, 2, 1, 0 }).
+struct PixelLayout
+{
+	int pixelBytes;
+	int rIdx, gIdx, bIdx;
+};
+
+inline PixelLayout MakePixelLayout(int pixelBytes, int rIdx, int gIdx, int bIdx)
+{
+	PixelLayout l = { pixelBytes, rIdx, gIdx, bIdx };
+	return l;
+}
+
+inline bool IsPackedRGB(const PixelLayout& l)
+{
+	return l.pixelBytes == 3 && l.rIdx == 0 && l.gIdx == 1 && l.bIdx == 2;
+}
+
+// ---------------------------------------------------------------------------
+// Scalar reference
+// ---------------------------------------------------------------------------
+
+// n host pixels -> n packed RGB pixels
+inline void ReadPixelsRGB(const BYTE* src, const PixelLayout& l, BYTE* dst, int n)
+{
+	if (IsPackedRGB(l))
+	{
+		memcpy(dst, src, static_cast<size_t>(n) * 3);
+		return;
+	}
+	for (int i = 0; i < n; ++i, src += l.pixelBytes, dst += 3)
+	{
+		dst[0] = src[l.rIdx];
+		dst[1] = src[l.gIdx];
+		dst[2] = src[l.bIdx];
+	}
+}
+
+// n packed RGB pixels -> n host pixels; bytes other than R, G and B (alpha
+// or padding) are left as they are
+inline void WritePixelsRGB(const BYTE* src, const PixelLayout& l, BYTE* dst, int n)
+{
+	if (IsPackedRGB(l))
+	{
+		memcpy(dst, src, static_cast<size_t>(n) * 3);
+		return;
+	}
+	for (int i = 0; i < n; ++i, src += 3, dst += l.pixelBytes)
+	{
+		dst[l.rIdx] = src[0];
+		dst[l.gIdx] = src[1];
+		dst[l.bIdx] = src[2];
+	}
+}
+
+// n single-channel values (selection) with the given stride -> n bytes
+inline void ReadPlane(const BYTE* src, int pixelBytes, BYTE* dst, int n)
+{
+	if (pixelBytes == 1)
+	{
+		memcpy(dst, src, n);
+		return;
+	}
+	for (int i = 0; i < n; ++i, src += pixelBytes)
+		dst[i] = *src;
+}
+
+// Clears the mask byte of every pixel whose alpha (n values with the given
+// stride) is 0. Returns true if any pixel was transparent.
+inline bool ClearTransparentPixels(const BYTE* alpha, int pixelBytes, BYTE* mask, int n)
+{
+	bool any = false;
+	for (int i = 0; i < n; ++i, alpha += pixelBytes)
+	{
+		if (*alpha == 0)
+		{
+			mask[i] = 0;
+			any = true;
+		}
+	}
+	return any;
+}
+
+// ---------------------------------------------------------------------------
+// Selection blend
+// ---------------------------------------------------------------------------
+
+// dst = orig + (sorted - orig) * mask / 255 per channel, with the division
+// truncating toward zero, for n packed RGB pixels. dst may be sorted or orig.
+inline void BlendPixelsRGB(const BYTE* sorted, const BYTE* orig, const BYTE* mask, BYTE* dst, int n)
+{
+	for (int i = 0; i < n; ++i, sorted += 3, orig += 3, dst += 3)
+	{
+		int alpha = mask[i];
+		for (int c = 0; c < 3; ++c)
+			dst[c] = static_cast<BYTE>(((sorted[c] - orig[c]) * alpha / 255) + orig[c]);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Tiled transpose
+// ---------------------------------------------------------------------------
+
+// A tile covers kTransposeTileCols source columns of kTransposeTileRows
+// source rows. Tall, narrow tiles write long runs of few destination rows
+// while each source row is read one short run at a time; on large images
+// that beats square tiles, which keep jumping to new destination pages.
+static const int kTransposeTileCols = 16;
+static const int kTransposeTileRows = 1024;
+
+// dst(x, y) = src(y, x): `rows` source rows of `cols` pixels become `cols`
+// destination rows of `rows` pixels
+template <int kPixelBytes>
+inline void TransposePixelsT(const BYTE* src, size_t srcRowBytes, BYTE* dst, size_t dstRowBytes, int cols, int rows)
+{
+	for (int y0 = 0; y0 < rows; y0 += kTransposeTileRows)
+	{
+		int y1 = (std::min)(rows, y0 + kTransposeTileRows);
+		for (int x0 = 0; x0 < cols; x0 += kTransposeTileCols)
+		{
+			int x1 = (std::min)(cols, x0 + kTransposeTileCols);
+			for (int x = x0; x < x1; ++x)
+			{
+				const BYTE* s = src + y0 * srcRowBytes + x * kPixelBytes;
+				BYTE* d = dst + x * dstRowBytes + y0 * kPixelBytes;
+				for (int y = y0; y < y1; ++y, s += srcRowBytes, d += kPixelBytes)
+					for (int c = 0; c < kPixelBytes; ++c)
+						d[c] = s[c];
+			}
+		}
+	}
+}
+
+// Packed RGB (3) or selection (1) pixels
+inline void TransposePixels(const BYTE* src, size_t srcRowBytes, BYTE* dst, size_t dstRowBytes, int pixelBytes, int cols, int rows)
+{
+	if (pixelBytes == 3)
+		TransposePixelsT<3>(src, srcRowBytes, dst, dstRowBytes, cols, rows);
+	else
+		TransposePixelsT<1>(src, srcRowBytes, dst, dstRowBytes, cols, rows);
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.1 kernels (4-byte pixels)
+// ---------------------------------------------------------------------------
+
+#if PIXELSORT_HAS_X86_SIMD
+
+// R, G and B at distinct offsets inside a 4-byte pixel
+inline bool IsShuffleLayout4(const PixelLayout& l)
+{
+	return l.pixelBytes == 4 &&
+		l.rIdx >= 0 && l.rIdx < 4 && l.gIdx >= 0 && l.gIdx < 4 && l.bIdx >= 0 && l.bIdx < 4 &&
+		l.rIdx != l.gIdx && l.rIdx != l.bIdx && l.gIdx != l.bIdx;
+}
+
+PIXELSORT_TARGET_SSE41
+inline void ReadPixelsRGB_SSE41(const BYTE* src, const PixelLayout& l, BYTE* dst, int n)
+{
+	if (!IsShuffleLayout4(l))
+	{
+		ReadPixelsRGB(src, l, dst, n);
+		return;
+	}
+
+	// 4 pixels -> 12 bytes, upper 4 bytes zero
+	char r = static_cast<char>(l.rIdx), g = static_cast<char>(l.gIdx), b = static_cast<char>(l.bIdx);
+	__m128i pick = _mm_setr_epi8(
+		r, g, b, r + 4, g + 4, b + 4, r + 8, g + 8, b + 8, r + 12, g + 12, b + 12, -1, -1, -1, -1);
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		const BYTE* s = src + i * 4;
+		__m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s)), pick);
+		__m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16)), pick);
+		__m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32)), pick);
+		__m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48)), pick);
+
+		BYTE* d = dst + i * 3;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d),      _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+	}
+	ReadPixelsRGB(src + i * 4, l, dst + i * 3, n - i);
+}
+
+PIXELSORT_TARGET_SSE41
+inline void WritePixelsRGB_SSE41(const BYTE* src, const PixelLayout& l, BYTE* dst, int n)
+{
+	if (!IsShuffleLayout4(l))
+	{
+		WritePixelsRGB(src, l, dst, n);
+		return;
+	}
+
+	// 12 bytes (4 pixels) -> 4-byte pixels; `keep` covers the untouched byte
+	alignas(16) char place[16];
+	alignas(16) char keepBytes[16];
+	for (int p = 0; p < 4; ++p)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			char c = -1;
+			if (j == l.rIdx) c = static_cast<char>(p * 3 + 0);
+			else if (j == l.gIdx) c = static_cast<char>(p * 3 + 1);
+			else if (j == l.bIdx) c = static_cast<char>(p * 3 + 2);
+			place[p * 4 + j] = c;
+			keepBytes[p * 4 + j] = (c < 0) ? -1 : 0;
+		}
+	}
+	__m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(place));
+	__m128i keep = _mm_load_si128(reinterpret_cast<const __m128i*>(keepBytes));
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		const BYTE* s = src + i * 3;
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+		__m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+		__m128i groups[4] =
+		{
+			a0,
+			_mm_alignr_epi8(a1, a0, 12),
+			_mm_alignr_epi8(a2, a1, 8),
+			_mm_srli_si128(a2, 4)
+		};
+
+		BYTE* d = dst + i * 4;
+		for (int k = 0; k < 4; ++k)
+		{
+			__m128i* dp = reinterpret_cast<__m128i*>(d + k * 16);
+			__m128i old = _mm_and_si128(_mm_loadu_si128(dp), keep);
+			_mm_storeu_si128(dp, _mm_or_si128(old, _mm_shuffle_epi8(groups[k], shuffle)));
+		}
+	}
+	WritePixelsRGB(src + i * 3, l, dst + i * 4, n - i);
+}
+
+// 16 channel bytes of the blend. |d| * alpha fits 16 unsigned bits, and
+// (x + 1 + (x >> 8)) >> 8 is x / 255 for every such x, so the result is
+// exactly the scalar one.
+PIXELSORT_TARGET_SSE41
+inline __m128i BlendBytes16_SSE41(__m128i sorted, __m128i orig, __m128i alpha)
+{
+	__m128i one = _mm_set1_epi16(1);
+	__m128i r[2];
+	for (int h = 0; h < 2; ++h)
+	{
+		__m128i s = _mm_cvtepu8_epi16(h ? _mm_srli_si128(sorted, 8) : sorted);
+		__m128i o = _mm_cvtepu8_epi16(h ? _mm_srli_si128(orig, 8) : orig);
+		__m128i a = _mm_cvtepu8_epi16(h ? _mm_srli_si128(alpha, 8) : alpha);
+		__m128i d = _mm_sub_epi16(s, o);
+		__m128i x = _mm_mullo_epi16(_mm_abs_epi16(d), a);
+		__m128i q = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+		r[h] = _mm_add_epi16(o, _mm_sign_epi16(q, d));
+	}
+	return _mm_packus_epi16(r[0], r[1]);
+}
+
+PIXELSORT_TARGET_SSE41
+inline void BlendPixelsRGB_SSE41(const BYTE* sorted, const BYTE* orig, const BYTE* mask, BYTE* dst, int n)
+{
+	// Mask byte of each channel byte in the three 16-byte parts of 16 pixels
+	const __m128i spread0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i spread1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i spread2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	const __m128i full = _mm_set1_epi8(-1);
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+		const BYTE* s = sorted + i * 3;
+		const BYTE* o = orig + i * 3;
+		BYTE* d = dst + i * 3;
+
+		// Whole groups of fully selected or unselected pixels are copies
+		if (_mm_test_all_ones(_mm_cmpeq_epi8(m, full)))
+		{
+			if (d != s) memmove(d, s, 48);
+			continue;
+		}
+		if (_mm_test_all_zeros(m, m))
+		{
+			if (d != o) memmove(d, o, 48);
+			continue;
+		}
+
+		__m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+		__m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+		__m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+		__m128i o0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(o));
+		__m128i o1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(o + 16));
+		__m128i o2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(o + 32));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d),      BlendBytes16_SSE41(s0, o0, _mm_shuffle_epi8(m, spread0)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d + 16), BlendBytes16_SSE41(s1, o1, _mm_shuffle_epi8(m, spread1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(d + 32), BlendBytes16_SSE41(s2, o2, _mm_shuffle_epi8(m, spread2)));
+	}
+	BlendPixelsRGB(sorted + i * 3, orig + i * 3, mask + i, dst + i * 3, n - i);
+}
+
+#endif // PIXELSORT_HAS_X86_SIMD
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+typedef void (*ReadPixelsRGBFunc)(const BYTE* src, const PixelLayout& l, BYTE* dst, int n);
+typedef void (*WritePixelsRGBFunc)(const BYTE* src, const PixelLayout& l, BYTE* dst, int n);
+typedef void (*BlendPixelsRGBFunc)(const BYTE* sorted, const BYTE* orig, const BYTE* mask, BYTE* dst, int n);
+
+struct PixelCopyKernel
+{
+	ReadPixelsRGBFunc  read;
+	WritePixelsRGBFunc write;
+	BlendPixelsRGBFunc blend;
+	const char*        name;
+};
+
+inline PixelCopyKernel SelectPixelCopyKernel()
+{
+	PixelCopyKernel k = { ReadPixelsRGB, WritePixelsRGB, BlendPixelsRGB, "scalar" };
+#if PIXELSORT_HAS_X86_SIMD
+	if (DetectCpuFeatures().sse41)
+	{
+		k.read = ReadPixelsRGB_SSE41;
+		k.write = WritePixelsRGB_SSE41;
+		k.blend = BlendPixelsRGB_SSE41;
+		k.name = "SSE4.1";
+	}
+#endif
+	return k;
+}
+
+// Kernel for this CPU, chosen by CPUID on first use (ModuleInitialize)
+inline const PixelCopyKernel& GetPixelCopyKernel()
+{
+	static const PixelCopyKernel kernel = SelectPixelCopyKernel();
+	return kernel;
+}
@@ -2,13 +2,12 @@
 //! @brief  Pixel sort enums, sort key functions, logging, and shared types
 #pragma once
 
-#include <windows.h>
 #include <cstdio>
 #include <cstdarg>
 #include <cmath>
 #include <algorithm>
 #include <vector>
-#include <random>
+#include <chrono>
 
 typedef unsigned char BYTE;
 
@@ -16,6 +15,27 @@ typedef unsigned char BYTE;
 // Diagnostics
 // ---------------------------------------------------------------------------
 
+// Receives every formatted PixelSortLog line. The plugin sends them to the
+// debugger (OutputDebugStringA); tools built on the engine alone get stderr.
+typedef void (*PixelSortLogSink)(const char* line);
+
+inline void PixelSortLogToStderr(const char* line)
+{
+	fputs(line, stderr);
+}
+
+inline PixelSortLogSink& PixelSortLogSinkSlot()
+{
+	static PixelSortLogSink sink = PixelSortLogToStderr;
+	return sink;
+}
+
+// NULL restores the stderr sink
+inline void PixelSortSetLogSink(PixelSortLogSink sink)
+{
+	PixelSortLogSinkSlot() = (sink != NULL) ? sink : PixelSortLogToStderr;
+}
+
 inline void PixelSortLog(const char* fmt, ...)
 {
 	char buf[512];
@@ -23,7 +43,13 @@ inline void PixelSortLog(const char* fmt, ...)
 	va_start(args, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, args);
 	va_end(args);
-	OutputDebugStringA(buf);
+	PixelSortLogSinkSlot()(buf);
+}
+
+// Monotonic clock for timing, in seconds
+inline double PixelSortSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 // ---------------------------------------------------------------------------
@@ -57,6 +83,13 @@ enum IntervalMode
 	kIntervalModeNone      = 4
 };
 
+// Gradients the Edges mode split threshold is taken over
+enum EdgeScope
+{
+	kEdgeScopeLine  = 0, // each line's own mean + stddev
+	kEdgeScopeImage = 1  // one threshold for every line of the image
+};
+
 // ---------------------------------------------------------------------------
 // Parameter struct
 // ---------------------------------------------------------------------------
@@ -74,8 +107,13 @@ struct PixelSortParams
 	int           spanMax;        // 0-10000, 0 = unlimited
 	int           angle;          // 0-359 degrees (only applies when direction=Horizontal)
 	int           falloff;        // 0-100 percent chance to skip sorting a span
+	EdgeScope     edgeScope;      // Edges mode threshold per line or per image
+	bool          skipTransparent; // zero-alpha pixels count as unselected
+	int           seed;           // 0-99999, random spans, falloff and jitter
 };
 
+static const int kPixelSortDefaultSeed = 42; // repeatable previews until the seed is changed
+
 inline PixelSortParams MakeDefaultParams()
 {
 	PixelSortParams p;
@@ -90,6 +128,9 @@ inline PixelSortParams MakeDefaultParams()
 	p.spanMax        = 0;
 	p.angle          = 0;
 	p.falloff        = 0;
+	p.edgeScope      = kEdgeScopeLine;
+	p.skipTransparent = false;
+	p.seed           = kPixelSortDefaultSeed;
 	return p;
 }
 
@@ -115,35 +156,138 @@ inline void ClampParams(PixelSortParams& p)
 
 	p.angle = ((p.angle % 360) + 360) % 360;
 	p.falloff = (std::max)(0, (std::min)(100, p.falloff));
+	if (p.edgeScope < 0 || p.edgeScope > 1)
+		p.edgeScope = kEdgeScopeLine;
+	p.seed = (std::max)(0, (std::min)(99999, p.seed));
 }
 
 // ---------------------------------------------------------------------------
-// Pixel data for sorting
+// Counter-based random numbers
 // ---------------------------------------------------------------------------
 
-struct PixelData
+// Every random draw is a pure function of (seed, stream, line, span or
+// pixel): any value can be computed on its own in O(1), so the result does
+// not depend on the order (or thread) in which lines and spans are sorted,
+// and one span can be redrawn without replaying the draws before it.
+
+// Each use draws from its own stream, so cached spans stay valid when only
+// falloff or jitter change
+enum RandomStream
 {
-	BYTE  r, g, b;
-	float sortValue;
+	kRandomStreamSpans   = 0x5350414E, // "SPAN": Random mode span lengths and gaps
+	kRandomStreamFalloff = 0x46414C4C, // "FALL": which spans are skipped
+	kRandomStreamJitter  = 0x4A495454  // "JITT": jitter offsets
 };
 
+// True if SortLine draws random numbers (falloff, jitter) for these params
+inline bool ParamsUseRandom(const PixelSortParams& p)
+{
+	return p.falloff > 0 || p.jitter > 0;
+}
+
+// Key of line `lineIndex` in `stream`: SplitMix64 finalizer over
+// (seed, stream, lineIndex)
+inline unsigned int MakeRandomLineKey(int seed, RandomStream stream, int lineIndex)
+{
+	unsigned long long z = (static_cast<unsigned long long>(static_cast<unsigned int>(seed) ^ static_cast<unsigned int>(stream)) << 32) ^
+		static_cast<unsigned int>(lineIndex);
+	z += 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return static_cast<unsigned int>(z ^ (z >> 32));
+}
+
+// Draw `counter` under `key` (a line key, or a span key made from one).
+// 32-bit multiplies and shifts only, so loops over counters vectorize.
+inline unsigned int RandomBits(unsigned int key, unsigned int counter)
+{
+	unsigned int x = key + counter * 0x9E3779B9U;
+	x = (x ^ (x >> 16)) * 0x7FEB352DU;
+	x = (x ^ (x >> 15)) * 0x846CA68BU;
+	return x ^ (x >> 16);
+}
+
+// Key of span `spanIndex` of a line, for draws per pixel of the span
+inline unsigned int MakeRandomSpanKey(unsigned int lineKey, int spanIndex)
+{
+	return RandomBits(lineKey ^ 0x85EBCA6BU, static_cast<unsigned int>(spanIndex));
+}
+
+// `bits` scaled to [0, range) (range > 0)
+inline int RandomBelow(unsigned int bits, int range)
+{
+	return static_cast<int>((static_cast<unsigned long long>(bits) * static_cast<unsigned int>(range)) >> 32);
+}
+
 // ---------------------------------------------------------------------------
-// Sort key functions
+// Stage dependencies (which params each pipeline stage reads)
 // ---------------------------------------------------------------------------
 
-inline float GetBrightness(BYTE r, BYTE g, BYTE b)
+// Horizontal sorts with a non-zero angle run on a rotated copy of the image
+inline bool ParamsUseAngle(const PixelSortParams& p)
 {
-	return 0.299f * r + 0.587f * g + 0.114f * b;
+	return p.angle != 0 && p.direction == kSortDirectionHorizontal;
+}
+
+// Vertical passes sort the image transposed, so every column is a row
+inline bool ParamsUseColumns(const PixelSortParams& p)
+{
+	return p.direction == kSortDirectionVertical;
+}
+
+// Edges mode splits every line at one threshold taken over the whole image
+inline bool ParamsUseImageEdgeLimit(const PixelSortParams& p)
+{
+	return p.intervalMode == kIntervalModeEdges && p.edgeScope == kEdgeScopeImage;
+}
+
+// Rotation: the angle when it applies, and whether the image is transposed
+inline bool SameRotationStage(const PixelSortParams& a, const PixelSortParams& b)
+{
+	if (ParamsUseColumns(a) != ParamsUseColumns(b)) return false;
+	bool useAngle = ParamsUseAngle(a);
+	if (useAngle != ParamsUseAngle(b)) return false;
+	return !useAngle || a.angle == b.angle;
+}
+
+// Key plane: rotation, sort key, and whether Edges needs a brightness plane
+inline bool SameKeyStage(const PixelSortParams& a, const PixelSortParams& b)
+{
+	return SameRotationStage(a, b) &&
+		a.sortKey == b.sortKey &&
+		(a.intervalMode == kIntervalModeEdges) == (b.intervalMode == kIntervalModeEdges);
 }
 
-inline float GetIntensity(BYTE r, BYTE g, BYTE b)
+// Span lists: rotation, line direction, interval mode and span limits, plus
+// sort key and thresholds in Threshold mode (Edges reads brightness only,
+// and its threshold scope)
+inline bool SameSpanStage(const PixelSortParams& a, const PixelSortParams& b)
 {
-	return (r + g + b) / 3.0f;
+	if (!SameRotationStage(a, b) ||
+		a.direction != b.direction ||
+		a.intervalMode != b.intervalMode ||
+		a.spanMin != b.spanMin ||
+		a.spanMax != b.spanMax)
+		return false;
+	if (a.intervalMode == kIntervalModeThreshold)
+		return a.sortKey == b.sortKey &&
+			a.lowerThreshold == b.lowerThreshold &&
+			a.upperThreshold == b.upperThreshold;
+	if (a.intervalMode == kIntervalModeEdges)
+		return a.edgeScope == b.edgeScope;
+	if (a.intervalMode == kIntervalModeRandom)
+		return a.seed == b.seed;
+	return true;
 }
 
-inline float GetMinimum(BYTE r, BYTE g, BYTE b)
+// ---------------------------------------------------------------------------
+// Sort key functions (float; GetSortKeyCode quantizes them)
+// ---------------------------------------------------------------------------
+
+inline float GetBrightness(BYTE r, BYTE g, BYTE b)
 {
-	return static_cast<float>((std::min)({r, g, b}));
+	return 0.299f * r + 0.587f * g + 0.114f * b;
 }
 
 inline float GetHue(BYTE rv, BYTE gv, BYTE bv)
@@ -186,41 +330,183 @@ inline float GetSaturation(BYTE rv, BYTE gv, BYTE bv)
 	return (maxC - minC) / maxC;
 }
 
-inline float GetSortValue(BYTE r, BYTE g, BYTE b, SortKey key)
+// ---------------------------------------------------------------------------
+// Integer sort key codes (used by the sort backends in PISortEngine.h)
+// ---------------------------------------------------------------------------
+
+// Number of distinct code values for a key; codes are in [0, range)
+inline int SortKeyCodeRange(SortKey key)
 {
 	switch (key)
 	{
-	case kSortKeyBrightness: return GetBrightness(r, g, b);
-	case kSortKeyHue:        return GetHue(r, g, b);
-	case kSortKeySaturation: return GetSaturation(r, g, b);
-	case kSortKeyIntensity:  return GetIntensity(r, g, b);
-	case kSortKeyMinimum:    return GetMinimum(r, g, b);
-	case kSortKeyRed:        return static_cast<float>(r);
-	case kSortKeyGreen:      return static_cast<float>(g);
-	case kSortKeyBlue:       return static_cast<float>(b);
-	default:                 return GetBrightness(r, g, b);
+	case kSortKeyIntensity: return 766;   // r + g + b
+	case kSortKeyMinimum:
+	case kSortKeyRed:
+	case kSortKeyGreen:
+	case kSortKeyBlue:      return 256;
+	default:                return 65536; // 16-bit quantized float key
 	}
 }
 
-// Brightness normalized to 0.0-1.0
-inline float GetBrightnessNorm(BYTE r, BYTE g, BYTE b)
+// Integer code of a pixel's sort key: the one definition of every key, which
+// the key kernels and tables reproduce. Red, Green, Blue, Minimum and
+// Intensity (r + g + b) are exact; Brightness is rounded to 1/256 and
+// Hue / Saturation to 16 bits over their full range, never inverting the
+// order of GetBrightness, GetHue and GetSaturation.
+inline unsigned short GetSortKeyCode(BYTE r, BYTE g, BYTE b, SortKey key)
 {
-	return (0.299f * r + 0.587f * g + 0.114f * b) / 255.0f;
+	switch (key)
+	{
+	case kSortKeyHue:
+		return static_cast<unsigned short>((std::min)(65535.0f, GetHue(r, g, b) * (65535.0f / 360.0f) + 0.5f));
+	case kSortKeySaturation:
+		return static_cast<unsigned short>(GetSaturation(r, g, b) * 65535.0f + 0.5f);
+	case kSortKeyIntensity:  return static_cast<unsigned short>(r + g + b);
+	case kSortKeyMinimum:    return (std::min)({r, g, b});
+	case kSortKeyRed:        return r;
+	case kSortKeyGreen:      return g;
+	case kSortKeyBlue:       return b;
+	case kSortKeyBrightness:
+	default:
+		return static_cast<unsigned short>(GetBrightness(r, g, b) * 256.0f + 0.5f);
+	}
 }
 
-// Sort value normalized to 0.0-1.0 (for threshold span detection)
-inline float GetSortValueNorm(BYTE r, BYTE g, BYTE b, SortKey key)
+// A 0-255 threshold expressed as a key code, so threshold span detection can
+// compare codes directly (value / 255 of the key's full range)
+inline int SortKeyThresholdCode(SortKey key, int threshold)
 {
 	switch (key)
 	{
-	case kSortKeyBrightness: return GetBrightness(r, g, b) / 255.0f;
-	case kSortKeyHue:        return GetHue(r, g, b) / 360.0f;
-	case kSortKeySaturation: return GetSaturation(r, g, b); // already 0-1
-	case kSortKeyIntensity:  return GetIntensity(r, g, b) / 255.0f;
-	case kSortKeyMinimum:    return GetMinimum(r, g, b) / 255.0f;
-	case kSortKeyRed:        return r / 255.0f;
-	case kSortKeyGreen:      return g / 255.0f;
-	case kSortKeyBlue:       return b / 255.0f;
-	default:                 return GetBrightness(r, g, b) / 255.0f;
+	case kSortKeyIntensity:  return threshold * 3;
+	case kSortKeyMinimum:
+	case kSortKeyRed:
+	case kSortKeyGreen:
+	case kSortKeyBlue:       return threshold;
+	case kSortKeyHue:
+	case kSortKeySaturation: return threshold * 257; // 255 * 257 = 65535
+	case kSortKeyBrightness:
+	default:                 return threshold * 256;
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Hue and saturation code tables
+// ---------------------------------------------------------------------------
+
+// GetSortKeyCode for Hue and Saturation without float math. A saturation
+// code depends only on (max, min). A hue code depends only on which channel
+// is the max (red first, then green, as GetHue tests them), the signed
+// difference of the other two in GetHue's order, and max - min: GetHue
+// divides exact differences of whole numbers, so the level cancels out.
+// Every entry is filled from GetSortKeyCode itself, so lookups match the
+// float codes bit for bit.
+struct KeyCodeTables
+{
+	enum
+	{
+		kHueDiffs  = 511, // difference + 255
+		kHueDeltas = 256  // max - min
+	};
+
+	std::vector<unsigned short> hue;        // [branch 0-2][difference][delta]
+	std::vector<unsigned short> saturation; // [max][min]
+
+	KeyCodeTables()
+		: hue(static_cast<size_t>(3) * kHueDiffs * kHueDeltas, 0)
+		, saturation(static_cast<size_t>(256) * 256, 0)
+	{
+		// One pixel per entry with the max channel at 255 covers every
+		// reachable (branch, difference, delta)
+		for (int u = 0; u < 256; ++u)
+		{
+			for (int v = 0; v < 256; ++v)
+			{
+				BYTE a = static_cast<BYTE>(u), c = static_cast<BYTE>(v);
+				hue[HueIndex(255, a, c)] = GetSortKeyCode(255, a, c, kSortKeyHue);
+				if (u < 255)
+					hue[HueIndex(a, 255, c)] = GetSortKeyCode(a, 255, c, kSortKeyHue);
+				if (u < 255 && v < 255)
+					hue[HueIndex(a, c, 255)] = GetSortKeyCode(a, c, 255, kSortKeyHue);
+				if (v <= u)
+					saturation[u * 256 + v] = GetSortKeyCode(a, c, c, kSortKeySaturation);
+			}
+		}
+	}
+
+	static int HueIndex(int r, int g, int b)
+	{
+		int maxC = (std::max)((std::max)(r, g), b);
+		int minC = (std::min)((std::min)(r, g), b);
+		int branch = (maxC == r) ? 0 : (maxC == g ? 1 : 2);
+		int diff = (maxC == r) ? g - b : (maxC == g ? b - r : r - g);
+		return (branch * kHueDiffs + diff + 255) * kHueDeltas + (maxC - minC);
+	}
+
+	unsigned short Hue(int r, int g, int b) const
+	{
+		return hue[HueIndex(r, g, b)];
+	}
+
+	unsigned short Saturation(int r, int g, int b) const
+	{
+		int maxC = (std::max)((std::max)(r, g), b);
+		int minC = (std::min)((std::min)(r, g), b);
+		return saturation[maxC * 256 + minC];
+	}
+};
+
+// Built on first use, once per module load (about 900 KB)
+inline const KeyCodeTables& GetKeyCodeTables()
+{
+	static const KeyCodeTables tables;
+	return tables;
+}
+
+// ---------------------------------------------------------------------------
+// Batch key computation (packed RGB, 3 bytes per pixel)
+// ---------------------------------------------------------------------------
+
+// Writes GetSortKeyCode for n pixels. The key switch is taken once per call
+// rather than once per pixel; Hue and Saturation are table lookups. Scalar
+// reference for the kernels in PIKeySIMD.h.
+inline void ComputeKeyCodesRGB(const BYTE* rgb, int n, SortKey key, unsigned short* out)
+{
+	switch (key)
+	{
+	case kSortKeyHue:
+	{
+		const KeyCodeTables& tables = GetKeyCodeTables();
+		for (int i = 0; i < n; ++i)
+			out[i] = tables.Hue(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+		break;
+	}
+	case kSortKeySaturation:
+	{
+		const KeyCodeTables& tables = GetKeyCodeTables();
+		for (int i = 0; i < n; ++i)
+			out[i] = tables.Saturation(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+		break;
+	}
+	case kSortKeyRed:
+		for (int i = 0; i < n; ++i) out[i] = rgb[i * 3 + 0];
+		break;
+	case kSortKeyGreen:
+		for (int i = 0; i < n; ++i) out[i] = rgb[i * 3 + 1];
+		break;
+	case kSortKeyBlue:
+		for (int i = 0; i < n; ++i) out[i] = rgb[i * 3 + 2];
+		break;
+	case kSortKeyIntensity:
+		for (int i = 0; i < n; ++i)
+			out[i] = static_cast<unsigned short>(rgb[i * 3] + rgb[i * 3 + 1] + rgb[i * 3 + 2]);
+		break;
+	default:
+		for (int i = 0; i < n; ++i)
+		{
+			const BYTE* p = rgb + i * 3;
+			out[i] = GetSortKeyCode(p[0], p[1], p[2], key);
+		}
+		break;
 	}
 }
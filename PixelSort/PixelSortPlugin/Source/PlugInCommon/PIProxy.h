@@ -0,0 +1,94 @@
+//! @file   PIProxy.h
+//! @brief  Low-resolution proxy images for interactive preview
+#pragma once
+
+#include "PIPixelSort.h"
+
+// ---------------------------------------------------------------------------
+// Proxy scale
+// ---------------------------------------------------------------------------
+
+// Previews of images larger than this are first rendered on a proxy
+static const int kProxyMaxPixels = 2000000;
+
+// Integer downsampling factor that brings w x h within kProxyMaxPixels
+// (1 = no proxy needed)
+inline int ProxyFactorFor(int w, int h)
+{
+	double pixels = static_cast<double>(w) * h;
+	if (pixels <= kProxyMaxPixels) return 1;
+	int factor = static_cast<int>(ceil(sqrt(pixels / kProxyMaxPixels)));
+	while (static_cast<double>((w + factor - 1) / factor) * ((h + factor - 1) / factor) > kProxyMaxPixels)
+		++factor;
+	return factor;
+}
+
+// Pixel-length params scaled to the proxy, so spans keep roughly the same
+// look relative to the image
+inline PixelSortParams ScaleParamsForProxy(const PixelSortParams& p, int factor)
+{
+	PixelSortParams s = p;
+	s.spanMin = (std::max)(1, (p.spanMin + factor / 2) / factor);
+	if (p.spanMax > 0)
+		s.spanMax = (std::max)(s.spanMin, (p.spanMax + factor / 2) / factor);
+	if (p.jitter > 0)
+		s.jitter = (std::max)(1, (p.jitter + factor / 2) / factor);
+	return s;
+}
+
+// ---------------------------------------------------------------------------
+// Resampling
+// ---------------------------------------------------------------------------
+
+// Box-filter downsample of a plane with `channels` bytes per pixel.
+// Edge cells average only the pixels they cover.
+inline void DownsampleBox(
+	const BYTE* src, int w, int h, int channels, int factor,
+	std::vector<BYTE>& dst, int& dstW, int& dstH)
+{
+	dstW = (w + factor - 1) / factor;
+	dstH = (h + factor - 1) / factor;
+	dst.resize(static_cast<size_t>(dstW) * dstH * channels);
+
+	for (int py = 0; py < dstH; ++py)
+	{
+		int y0 = py * factor, y1 = (std::min)(h, y0 + factor);
+		for (int px = 0; px < dstW; ++px)
+		{
+			int x0 = px * factor, x1 = (std::min)(w, x0 + factor);
+			int count = (y1 - y0) * (x1 - x0);
+			for (int c = 0; c < channels; ++c)
+			{
+				int sum = 0;
+				for (int y = y0; y < y1; ++y)
+				{
+					const BYTE* row = src + (static_cast<size_t>(y) * w + x0) * channels + c;
+					for (int x = x0; x < x1; ++x, row += channels)
+						sum += *row;
+				}
+				dst[(static_cast<size_t>(py) * dstW + px) * channels + c] = static_cast<BYTE>((sum + count / 2) / count);
+			}
+		}
+	}
+}
+
+// Nearest-neighbour upsample of a packed RGB proxy to w x h. Pixels whose
+// selection is 0 keep the original, so unselected areas stay sharp.
+inline void UpsampleNearestRGB(
+	const BYTE* proxy, int proxyW, int factor,
+	const BYTE* orig, const BYTE* select, // select may be NULL
+	BYTE* dst, int w, int h)
+{
+	for (int y = 0; y < h; ++y)
+	{
+		const BYTE* prow = proxy + static_cast<size_t>(y / factor) * proxyW * 3;
+		for (int x = 0; x < w; ++x)
+		{
+			size_t i = static_cast<size_t>(y) * w + x;
+			const BYTE* sp = (select != NULL && select[i] == 0) ? orig + i * 3 : prow + (x / factor) * 3;
+			dst[i * 3 + 0] = sp[0];
+			dst[i * 3 + 1] = sp[1];
+			dst[i * 3 + 2] = sp[2];
+		}
+	}
+}
@@ -0,0 +1,51 @@
+//! @file   PISelectCoverage.h
+//! @brief  Selection coverage of mask runs, lines and host blocks
+#pragma once
+
+#include "PIPixelSort.h"
+#include <cstring>
+
+// ---------------------------------------------------------------------------
+// Coverage
+// ---------------------------------------------------------------------------
+
+// How much of a run of selection bytes is selected. Unselected runs are
+// never changed by a sort and fully selected runs need no blending, so both
+// skip the per-pixel mask.
+enum SelectCoverage
+{
+	kSelectCoverageNone    = 0, // every byte 0
+	kSelectCoveragePartial = 1,
+	kSelectCoverageFull    = 2  // every byte 255
+};
+
+// Coverage of two runs taken together
+inline SelectCoverage CombineCoverage(SelectCoverage a, SelectCoverage b)
+{
+	return (a == b) ? a : kSelectCoveragePartial;
+}
+
+// Coverage of n mask bytes (an empty run counts as unselected). Reads eight
+// bytes at a time and stops as soon as the run is known to be partial.
+inline SelectCoverage MaskCoverage(const BYTE* mask, size_t n)
+{
+	if (n == 0) return kSelectCoverageNone;
+
+	unsigned long long any = 0, all = ~0ULL;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, mask + i, sizeof(word));
+		any |= word;
+		all &= word;
+		if (any != 0 && all != ~0ULL) return kSelectCoveragePartial;
+	}
+	for (; i < n; ++i)
+	{
+		any |= mask[i];
+		all &= 0xFFFFFFFFFFFFFF00ULL | mask[i];
+	}
+	if (any == 0) return kSelectCoverageNone;
+	return (all == ~0ULL) ? kSelectCoverageFull : kSelectCoveragePartial;
+}
@@ -0,0 +1,332 @@
+//! @file   PISortEngine.h
+//! @brief  Stable integer-key sort backends over packed span records
+#pragma once
+
+#include "PIPixelSort.h"
+#include "PIThreadPool.h"
+#include <cstring>
+
+// ---------------------------------------------------------------------------
+// Sort records
+// ---------------------------------------------------------------------------
+
+// A span pixel is sorted as one integer, (key code << index bits) | its
+// position among the span's included pixels. Positions are unique, so
+// ordering whole records is a stable sort by key, and the pixels are then
+// gathered once through the positions. 32-bit records cover spans up to
+// 65536 included pixels; longer spans use 64-bit records.
+typedef unsigned int       SortRecord32;
+typedef unsigned long long SortRecord64;
+
+template <class Record> struct SortRecordTraits;
+
+template <> struct SortRecordTraits<SortRecord32>
+{
+	static const int kIndexBits = 16;
+};
+
+template <> struct SortRecordTraits<SortRecord64>
+{
+	static const int kIndexBits = 32;
+};
+
+static const int kSortRecord32MaxCount = 1 << SortRecordTraits<SortRecord32>::kIndexBits;
+
+template <class Record>
+inline Record MakeSortRecord(unsigned short key, int position)
+{
+	return (static_cast<Record>(key) << SortRecordTraits<Record>::kIndexBits) | static_cast<Record>(position);
+}
+
+template <class Record>
+inline int SortRecordPosition(Record r)
+{
+	return static_cast<int>(r & ((static_cast<Record>(1) << SortRecordTraits<Record>::kIndexBits) - 1));
+}
+
+template <class Record>
+inline unsigned int SortRecordKey(Record r)
+{
+	return static_cast<unsigned int>(r >> SortRecordTraits<Record>::kIndexBits);
+}
+
+// ---------------------------------------------------------------------------
+// Backend selection
+// ---------------------------------------------------------------------------
+
+// Spans up to this many pixels use insertion sort; longer spans use a
+// counting sort (small key ranges) or an LSD radix sort (16-bit codes).
+static const int kInsertionSortMaxCount = 32;
+
+// Key ranges up to this size are sorted with a single counting pass, unless
+// the machine's tuning profile says otherwise
+static const int kCountingSortMaxRange = 1024;
+
+// Scratch reused across spans by one worker
+struct SortEngineScratch
+{
+	std::vector<SortRecord32> temp32;
+	std::vector<SortRecord64> temp64;
+	std::vector<int>          counts;
+	int                       countingMaxRange; // set per render from RenderTuning
+
+	SortEngineScratch() : countingMaxRange(kCountingSortMaxRange) {}
+};
+
+inline std::vector<SortRecord32>& SortTemp(SortEngineScratch& scratch, SortRecord32*)
+{
+	return scratch.temp32;
+}
+
+inline std::vector<SortRecord64>& SortTemp(SortEngineScratch& scratch, SortRecord64*)
+{
+	return scratch.temp64;
+}
+
+// ---------------------------------------------------------------------------
+// Insertion sort (short spans)
+// ---------------------------------------------------------------------------
+
+template <class Record>
+inline void InsertionSortRecords(Record* p, int n)
+{
+	for (int i = 1; i < n; ++i)
+	{
+		Record v = p[i];
+		int j = i - 1;
+		while (j >= 0 && p[j] > v)
+		{
+			p[j + 1] = p[j];
+			--j;
+		}
+		p[j + 1] = v;
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Counting sort on the full key (key range <= scratch.countingMaxRange)
+// ---------------------------------------------------------------------------
+
+template <class Record>
+inline void CountingSortRecords(Record* p, int n, int keyRange, SortEngineScratch& scratch)
+{
+	std::vector<int>& counts = scratch.counts;
+	counts.assign(keyRange, 0);
+	for (int i = 0; i < n; ++i)
+		++counts[SortRecordKey(p[i])];
+
+	int sum = 0;
+	for (int k = 0; k < keyRange; ++k)
+	{
+		int c = counts[k];
+		counts[k] = sum;
+		sum += c;
+	}
+
+	std::vector<Record>& temp = SortTemp(scratch, static_cast<Record*>(NULL));
+	temp.resize(n);
+	Record* out = temp.data();
+	for (int i = 0; i < n; ++i)
+		out[counts[SortRecordKey(p[i])]++] = p[i];
+	memcpy(p, out, n * sizeof(Record));
+}
+
+// ---------------------------------------------------------------------------
+// LSD radix sort on 16-bit keys (two 8-bit digit passes)
+// ---------------------------------------------------------------------------
+
+template <class Record>
+inline void RadixSortRecords16(Record* p, int n, SortEngineScratch& scratch)
+{
+	const int indexBits = SortRecordTraits<Record>::kIndexBits;
+	std::vector<int>& counts = scratch.counts;
+	counts.assign(512, 0);
+	int* lo = counts.data();
+	int* hi = lo + 256;
+	for (int i = 0; i < n; ++i)
+	{
+		unsigned int key = SortRecordKey(p[i]);
+		++lo[key & 0xFF];
+		++hi[key >> 8];
+	}
+
+	std::vector<Record>& temp = SortTemp(scratch, static_cast<Record*>(NULL));
+	temp.resize(n);
+	Record* src = p;
+	Record* dst = temp.data();
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int* hist = (pass == 0) ? lo : hi;
+		int shift = indexBits + pass * 8;
+
+		// A digit shared by every key leaves the order unchanged
+		if (hist[static_cast<int>(src[0] >> shift) & 0xFF] == n)
+			continue;
+
+		int sum = 0;
+		for (int k = 0; k < 256; ++k)
+		{
+			int c = hist[k];
+			hist[k] = sum;
+			sum += c;
+		}
+		for (int i = 0; i < n; ++i)
+			dst[hist[static_cast<int>(src[i] >> shift) & 0xFF]++] = src[i];
+		std::swap(src, dst);
+	}
+
+	if (src != p)
+		memcpy(p, src, n * sizeof(Record));
+}
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+// Ascending sort of records by key; equal keys keep their position order,
+// whichever backend runs.
+template <class Record>
+inline void SortRecordsByKey(std::vector<Record>& records, SortKey key, SortEngineScratch& scratch)
+{
+	int n = static_cast<int>(records.size());
+	if (n < 2) return;
+
+	if (n <= kInsertionSortMaxCount)
+		InsertionSortRecords(records.data(), n);
+	else if (SortKeyCodeRange(key) <= scratch.countingMaxRange)
+		CountingSortRecords(records.data(), n, SortKeyCodeRange(key), scratch);
+	else
+		RadixSortRecords16(records.data(), n, scratch);
+}
+
+// ---------------------------------------------------------------------------
+// Parallel sort (one very long span over the whole pool)
+// ---------------------------------------------------------------------------
+
+// Spans with at least this many included pixels may be sorted by every
+// worker of the pool at once (see LineScratch::spanPool)
+static const int kParallelSortMinCount = 16384;
+
+// `fn(begin, end)` over [0, n) in one chunk per worker of `pool`, or in a
+// single call when there is no pool
+template <class Fn>
+inline void ForEachChunk(PixelSortThreadPool* pool, int n, const Fn& fn)
+{
+	if (pool == NULL || pool->GetThreadCount() == 1)
+	{
+		fn(0, n);
+		return;
+	}
+	int chunks = pool->GetThreadCount();
+	int chunkLen = (n + chunks - 1) / chunks;
+	pool->ParallelFor(chunks, 1, [&](int, int begin, int end)
+	{
+		for (int c = begin; c < end; ++c)
+		{
+			int i0 = c * chunkLen;
+			int i1 = (std::min)(n, i0 + chunkLen);
+			if (i0 < i1) fn(i0, i1);
+		}
+	});
+}
+
+// One stable counting pass from src to dst on the digit
+// (record >> shift) & digitMask, which is below bucketCount. Every chunk
+// counts its digits, one prefix over (digit, chunk) gives each chunk its
+// output offsets, then the chunks scatter their records side by side.
+// Returns false, with nothing written, if every record has the same digit.
+template <class Record>
+inline bool ParallelCountingPass(
+	PixelSortThreadPool& pool,
+	const Record* src, Record* dst, int n,
+	int shift, unsigned int digitMask, int bucketCount,
+	std::vector<int>& counts)
+{
+	int chunks = pool.GetThreadCount();
+	int chunkLen = (n + chunks - 1) / chunks;
+	counts.assign(static_cast<size_t>(chunks) * bucketCount, 0);
+	pool.ParallelFor(chunks, 1, [&](int, int begin, int end)
+	{
+		for (int c = begin; c < end; ++c)
+		{
+			int* hist = counts.data() + static_cast<size_t>(c) * bucketCount;
+			int i1 = (std::min)(n, (c + 1) * chunkLen);
+			for (int i = c * chunkLen; i < i1; ++i)
+				++hist[static_cast<unsigned int>(src[i] >> shift) & digitMask];
+		}
+	});
+
+	// A digit shared by every record leaves the order unchanged
+	unsigned int first = static_cast<unsigned int>(src[0] >> shift) & digitMask;
+	int firstCount = 0;
+	for (int c = 0; c < chunks; ++c)
+		firstCount += counts[static_cast<size_t>(c) * bucketCount + first];
+	if (firstCount == n) return false;
+
+	int sum = 0;
+	for (int d = 0; d < bucketCount; ++d)
+	{
+		for (int c = 0; c < chunks; ++c)
+		{
+			int& slot = counts[static_cast<size_t>(c) * bucketCount + d];
+			int count = slot;
+			slot = sum;
+			sum += count;
+		}
+	}
+
+	pool.ParallelFor(chunks, 1, [&](int, int begin, int end)
+	{
+		for (int c = begin; c < end; ++c)
+		{
+			int* offsets = counts.data() + static_cast<size_t>(c) * bucketCount;
+			int i1 = (std::min)(n, (c + 1) * chunkLen);
+			for (int i = c * chunkLen; i < i1; ++i)
+				dst[offsets[static_cast<unsigned int>(src[i] >> shift) & digitMask]++] = src[i];
+		}
+	});
+	return true;
+}
+
+// SortRecordsByKey over the whole pool: one counting pass for small key
+// ranges, two 8-bit radix passes otherwise. Records are unique, so the
+// result is the one every sequential backend gives.
+template <class Record>
+inline void ParallelSortRecordsByKey(
+	PixelSortThreadPool& pool,
+	std::vector<Record>& records,
+	SortKey key,
+	SortEngineScratch& scratch)
+{
+	int n = static_cast<int>(records.size());
+	if (n < kParallelSortMinCount || pool.GetThreadCount() == 1)
+	{
+		SortRecordsByKey(records, key, scratch);
+		return;
+	}
+
+	const int indexBits = SortRecordTraits<Record>::kIndexBits;
+	std::vector<Record>& temp = SortTemp(scratch, static_cast<Record*>(NULL));
+	temp.resize(n);
+	Record* src = records.data();
+	Record* dst = temp.data();
+
+	int keyRange = SortKeyCodeRange(key);
+	if (keyRange <= scratch.countingMaxRange)
+	{
+		if (ParallelCountingPass(pool, src, dst, n, indexBits, ~0U, keyRange, scratch.counts))
+			std::swap(src, dst);
+	}
+	else
+	{
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			if (ParallelCountingPass(pool, src, dst, n, indexBits + pass * 8, 0xFFU, 256, scratch.counts))
+				std::swap(src, dst);
+		}
+	}
+
+	if (src != records.data())
+		memcpy(records.data(), src, n * sizeof(Record));
+}
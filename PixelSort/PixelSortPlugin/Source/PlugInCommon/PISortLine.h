@@ -0,0 +1,356 @@
+//! @file   PISortLine.h
+//! @brief  Line sort kernels: spans of a row, column or traced line sorted by key
+#pragma once
+
+#include "PIPixelSort.h"
+#include "PIEdgeScan.h"
+#include "PIPixelCopy.h"
+#include "PISelectCoverage.h"
+#include "PISortEngine.h"
+#include "PISpanDetector.h"
+#include "PIThreadPool.h"
+#include <cstring>
+#include <utility>
+
+// ---------------------------------------------------------------------------
+// Per-worker scratch buffers for SortLine
+// ---------------------------------------------------------------------------
+
+struct LineScratch
+{
+	std::vector<BYTE>         lineStaging; // packed RGB row staged before it goes to the destination
+	std::vector<BYTE>         columnStrip; // vertical passes: the task's columns as packed RGB rows
+	std::vector<Span>         rowSpans;    // streaming passes: spans of the current row
+	EdgeStats                 edgeStats;   // image-wide Edges threshold: this worker's share
+	std::vector<BYTE>         spanPixels;      // packed RGB of a span's included pixels
+	std::vector<int>          includedIndices; // their offsets within the span
+	std::vector<SortRecord32> records32;
+	std::vector<SortRecord64> records64;
+	SortEngineScratch         sortWork;
+	std::vector<int>          jitterTargets; // swap partner of each record of the span being jittered
+
+	// Set only while the pool is idle and this scratch's lines are sorted on
+	// the calling thread: spans of kParallelSortMinCount pixels or more are
+	// then gathered, sorted and written back by every worker
+	PixelSortThreadPool*      spanPool;
+
+	LineScratch() : spanPool(NULL) {}
+};
+
+// ---------------------------------------------------------------------------
+// Sort a single line (row, column or traced line) of pixels
+// ---------------------------------------------------------------------------
+
+// First selected position in [i, end), or end. Unselected runs are skipped
+// eight mask bytes at a time.
+inline int SkipUnselected(const BYTE* select, int i, int end)
+{
+	for (; i + 8 <= end; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, select + i, sizeof(word));
+		if (word != 0) break;
+	}
+	while (i < end && select[i] == 0)
+		++i;
+	return i;
+}
+
+// Falloff: whether span si of a line is left unsorted. `falloffKey` is the
+// line's key in kRandomStreamFalloff.
+inline bool SpanFallsOff(const PixelSortParams& params, unsigned int falloffKey, int si)
+{
+	return RandomBelow(RandomBits(falloffKey, static_cast<unsigned int>(si)), 100) < params.falloff;
+}
+
+// Jitter: order[i] swaps with one up to params.jitter away, i ascending.
+// The partners are drawn up front (each is its own counter under the span's
+// `jitterKey`, so the draw loop vectorizes and splits over `pool`); the
+// swaps then run in order.
+template <class T>
+inline void JitterOrder(T* order, int count, const PixelSortParams& params, unsigned int jitterKey,
+	std::vector<int>& targets, PixelSortThreadPool* pool)
+{
+	targets.resize(count);
+	int* target = targets.data();
+	int range = 2 * params.jitter + 1;
+	ForEachChunk(pool, count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+			target[i] = i + RandomBelow(RandomBits(jitterKey, static_cast<unsigned int>(i)), range) - params.jitter;
+	});
+	for (int i = 0; i < count; ++i)
+	{
+		int j = (std::max)(0, (std::min)(count - 1, target[i]));
+		std::swap(order[i], order[j]);
+	}
+}
+
+// SortLine is instantiated for every combination of the per-line choices
+// below, so each copy only carries the work its params ask for and the
+// tests fold away at compile time. The sort key and interval mode need no
+// variant of their own: keys arrive as codes from the key plane and spans
+// are detected before the sort (stage 3).
+enum LineVariantFlags
+{
+	kLineVariantMasked  = 1, // partially selected line: spans read the mask
+	kLineVariantReverse = 2,
+	kLineVariantJitter  = 4,
+	kLineVariantFalloff = 8,
+	kLineVariantCount   = 16,
+	kLineVariantGeneric = -1 // every choice read from the params (reference)
+};
+
+// Set to 1 to run every line through the generic variant, the reference the
+// specialized ones must match
+#ifndef PIXELSORT_GENERIC_LINE_KERNEL
+#define PIXELSORT_GENERIC_LINE_KERNEL 0
+#endif
+
+// Whether `variant` has `flag`; the generic variant takes `value` instead
+inline bool LineVariantHas(int variant, int flag, bool value)
+{
+	return (variant == kLineVariantGeneric) ? value : (variant & flag) != 0;
+}
+
+// Variant bits for these params (mask excluded: it is chosen per line)
+inline int LineVariantOf(const PixelSortParams& params)
+{
+	return (params.reverse ? kLineVariantReverse : 0) |
+		(params.jitter > 0 ? kLineVariantJitter : 0) |
+		(params.falloff > 0 ? kLineVariantFalloff : 0);
+}
+
+// Sorts one span in a single pass: the included pixels' colors go to
+// scratch.spanPixels and their key records to `records` as they are read,
+// then the records are sorted and the pixels written back with one gather
+// through the record positions. With a selection, unselected pixels are
+// left out and scratch.includedIndices keeps the span offsets of the rest;
+// partial selection is not blended here.
+template <int Variant, class Record, class LineAccessor>
+inline void SortSpan(
+	const LineAccessor& row,
+	const KeyLine& keys,
+	int spanStart,
+	int spanLen,
+	const PixelSortParams& params,
+	const BYTE* selectArea,
+	unsigned int jitterKey, // span key of the jitter draws (see MakeRandomSpanKey)
+	LineScratch& scratch,
+	std::vector<Record>& records)
+{
+	const bool masked  = LineVariantHas(Variant, kLineVariantMasked, selectArea != NULL);
+	const bool reverse = LineVariantHas(Variant, kLineVariantReverse, params.reverse);
+	const bool jitter  = LineVariantHas(Variant, kLineVariantJitter, params.jitter > 0);
+
+	std::vector<BYTE>& spanPixels      = scratch.spanPixels;
+	std::vector<int>&  includedIndices = scratch.includedIndices;
+
+	spanPixels.resize(static_cast<size_t>(spanLen) * 3);
+	records.resize(spanLen);
+	BYTE*   out = spanPixels.data();
+	Record* rec = records.data();
+	int count = 0;
+
+	// Very long spans: every step but the masked gather, reverse and the
+	// jitter swaps is split over the pool
+	PixelSortThreadPool* pool = (spanLen >= kParallelSortMinCount) ? scratch.spanPool : NULL;
+
+	if (!masked)
+	{
+		ForEachChunk(pool, spanLen, [&](int begin, int end)
+		{
+			BYTE* px = out + static_cast<size_t>(begin) * 3;
+			for (int i = begin; i < end; ++i, px += 3)
+			{
+				row.getRGB(spanStart + i, px[0], px[1], px[2]);
+				rec[i] = MakeSortRecord<Record>(keys.at(spanStart + i), i);
+			}
+		});
+		count = spanLen;
+	}
+	else
+	{
+		const BYTE* sel = selectArea + spanStart;
+		includedIndices.resize(spanLen);
+		int* included = includedIndices.data();
+		for (int i = SkipUnselected(sel, 0, spanLen); i < spanLen; i = SkipUnselected(sel, i + 1, spanLen))
+		{
+			row.getRGB(spanStart + i, out[0], out[1], out[2]);
+			out += 3;
+			rec[count] = MakeSortRecord<Record>(keys.at(spanStart + i), count);
+			included[count++] = i;
+		}
+	}
+	if (count < 2) return;
+	records.resize(count);
+	if (count < kParallelSortMinCount)
+		pool = NULL;
+
+	// Sort by sort key (stable; backend picked from span length and key range)
+	if (pool != NULL)
+		ParallelSortRecordsByKey(*pool, records, params.sortKey, scratch.sortWork);
+	else
+		SortRecordsByKey(records, params.sortKey, scratch.sortWork);
+
+	// Reverse if requested
+	if (reverse)
+	{
+		std::reverse(records.begin(), records.end());
+	}
+
+	// Apply jitter if requested
+	if (jitter)
+		JitterOrder(records.data(), count, params, jitterKey, scratch.jitterTargets, pool);
+
+	// Write sorted pixels back to the included positions. Partially
+	// selected pixels are blended with the original afterwards, in one pass
+	// over the finished image (see BlendPixelsRGB).
+	const BYTE* pixels = spanPixels.data();
+	const Record* order = records.data();
+	const int* positions = masked ? includedIndices.data() : NULL;
+	ForEachChunk(pool, count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			const BYTE* sorted = pixels + SortRecordPosition(order[i]) * 3;
+			row.setRGB(spanStart + (masked ? positions[i] : i), sorted[0], sorted[1], sorted[2]);
+		}
+	});
+}
+
+// SortSpan with the record width the span length needs
+template <int Variant, class LineAccessor>
+inline void SortSpanRecords(
+	const LineAccessor& row,
+	const KeyLine& keys,
+	int spanStart,
+	int spanLen,
+	const PixelSortParams& params,
+	const BYTE* selectArea,
+	unsigned int jitterKey,
+	LineScratch& scratch)
+{
+	if (spanLen <= kSortRecord32MaxCount)
+		SortSpan<Variant>(row, keys, spanStart, spanLen, params, selectArea, jitterKey, scratch, scratch.records32);
+	else
+		SortSpan<Variant>(row, keys, spanStart, spanLen, params, selectArea, jitterKey, scratch, scratch.records64);
+}
+
+// LineAccessor is RowAccessor, PackedRowAccessor or IndexedRowAccessor.
+// Variant is a set of LineVariantFlags or kLineVariantGeneric.
+template <int Variant, class LineAccessor>
+inline void SortLine(
+	const LineAccessor& row,
+	const KeyLine& keys,          // sort key codes for the same line
+	const std::vector<Span>& spans, // spans detected on the same line
+	const PixelSortParams& params,
+	const BYTE* selectArea,       // NULL if no selection, otherwise 0-255 per pixel of the line
+	int rowIndex,
+	LineScratch& scratch)
+{
+	// Fully selected spans of a masked line sort as unmasked ones
+	const int  unmaskedVariant = (Variant == kLineVariantGeneric) ? Variant : (Variant & ~kLineVariantMasked);
+	const bool masked  = LineVariantHas(Variant, kLineVariantMasked, selectArea != NULL);
+	const bool falloff = LineVariantHas(Variant, kLineVariantFalloff, params.falloff > 0);
+	const bool jitter  = LineVariantHas(Variant, kLineVariantJitter, params.jitter > 0);
+
+	int n = row.length;
+	if (n <= 0) return;
+
+	// Span si skips on draw si of the falloff key and jitters under span key
+	// si of the jitter key
+	unsigned int falloffKey = falloff ? MakeRandomLineKey(params.seed, kRandomStreamFalloff, rowIndex) : 0;
+	unsigned int jitterLineKey = jitter ? MakeRandomLineKey(params.seed, kRandomStreamJitter, rowIndex) : 0;
+
+	for (int si = 0; si < static_cast<int>(spans.size()); ++si)
+	{
+		int spanStart = spans[si].start;
+		int spanLen   = (std::min)(spans[si].end, n) - spanStart;
+		if (spanLen < 2) continue;
+
+		// Falloff: randomly skip this span
+		if (falloff && SpanFallsOff(params, falloffKey, si))
+			continue;
+		unsigned int jitterKey = jitter ? MakeRandomSpanKey(jitterLineKey, si) : 0;
+
+		// Unselected spans stay as they are; fully selected ones skip the mask
+		if (masked)
+		{
+			SelectCoverage coverage = MaskCoverage(selectArea + spanStart, spanLen);
+			if (coverage == kSelectCoverageNone) continue;
+			if (coverage == kSelectCoveragePartial)
+			{
+				SortSpanRecords<Variant>(row, keys, spanStart, spanLen, params, selectArea, jitterKey, scratch);
+				continue;
+			}
+		}
+		SortSpanRecords<unmaskedVariant>(row, keys, spanStart, spanLen, params, NULL, jitterKey, scratch);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Line kernel dispatch (picked once per render from the params)
+// ---------------------------------------------------------------------------
+
+template <class LineAccessor>
+struct SortLineKernel
+{
+	typedef void (*Func)(const LineAccessor& row, const KeyLine& keys, const std::vector<Span>& spans,
+		const PixelSortParams& params, const BYTE* selectArea, int rowIndex, LineScratch& scratch);
+
+	Func unmasked; // no selection, or a fully selected line
+	Func masked;   // partially selected line
+
+	// Same arguments as SortLine
+	void Sort(const LineAccessor& row, const KeyLine& keys, const std::vector<Span>& spans,
+		const PixelSortParams& params, const BYTE* selectArea, int rowIndex, LineScratch& scratch) const
+	{
+		(selectArea != NULL ? masked : unmasked)(row, keys, spans, params, selectArea, rowIndex, scratch);
+	}
+};
+
+// SortLine for variant bits `v`, out of a table of every instantiation
+template <class LineAccessor, int... V>
+inline typename SortLineKernel<LineAccessor>::Func SortLineVariantAt(int v, std::integer_sequence<int, V...>)
+{
+	static const typename SortLineKernel<LineAccessor>::Func table[] = { &SortLine<V, LineAccessor>... };
+	return table[v];
+}
+
+template <class LineAccessor>
+inline SortLineKernel<LineAccessor> SelectSortLineKernel(const PixelSortParams& params)
+{
+	SortLineKernel<LineAccessor> k;
+#if PIXELSORT_GENERIC_LINE_KERNEL
+	(void)params;
+	k.unmasked = k.masked = &SortLine<kLineVariantGeneric, LineAccessor>;
+#else
+	std::make_integer_sequence<int, kLineVariantCount> variants;
+	int v = LineVariantOf(params);
+	k.unmasked = SortLineVariantAt<LineAccessor>(v, variants);
+	k.masked = SortLineVariantAt<LineAccessor>(v | kLineVariantMasked, variants);
+#endif
+	return k;
+}
+
+
+// ---------------------------------------------------------------------------
+// Staged rows
+// ---------------------------------------------------------------------------
+
+// scratch.lineStaging as a packed row of `length` pixels
+inline PackedRowAccessor StagedRow(LineScratch& scratch, int length)
+{
+	PackedRowAccessor packed;
+	packed.imageBase = scratch.lineStaging.data();
+	packed.length = length;
+	return packed;
+}
+
+// Blends a partially selected staged row (sorted) with its source pixels
+inline void BlendStagedRow(const BYTE* src, const BYTE* select, int length, LineScratch& scratch)
+{
+	BYTE* st = scratch.lineStaging.data();
+	GetPixelCopyKernel().blend(st, src, select, st, length);
+}
@@ -3,6 +3,8 @@
 #pragma once
 
 #include "PIPixelSort.h"
+#include "PIKeyPlane.h"
+#include "PIEdgeScan.h"
 #include <cmath>
 
 #ifndef M_PI
@@ -20,27 +22,55 @@ struct Span
 };
 
 // ---------------------------------------------------------------------------
-// Row accessor - abstracts horizontal vs vertical pixel access
+// Span emitter - applies span_min and span_max as each span is found
+// ---------------------------------------------------------------------------
+
+// Detectors hand every raw span to Emit, which drops it if shorter than
+// spanMin and splits it into spanMax pieces, so the final list is written
+// in one pass with no filtering afterwards.
+struct SpanEmitter
+{
+	std::vector<Span>* out;
+	int                spanMin; // drop shorter spans (<= 1: keep all)
+	int                spanMax; // split longer spans (<= 0: no cap)
+
+	void Emit(int start, int end) const
+	{
+		int len = end - start;
+		if (len < spanMin) return;
+		if (spanMax <= 0 || len <= spanMax)
+		{
+			Span s;
+			s.start = start;
+			s.end = end;
+			out->push_back(s);
+			return;
+		}
+		for (int s0 = start; s0 < end; s0 += spanMax)
+		{
+			Span s;
+			s.start = s0;
+			s.end = (std::min)(s0 + spanMax, end);
+			out->push_back(s);
+		}
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Row accessor - one row of interleaved pixels (columns are sorted as rows
+// of a transposed copy)
 // ---------------------------------------------------------------------------
 
 struct RowAccessor
 {
 	BYTE*         imageBase;
 	int           imagePixelBytes;
-	int           imageRowBytes;
 	int           rIdx, gIdx, bIdx;
 	int           length;
-	bool          vertical; // if true, iterate down a column instead of across a row
-
-	// Stride between consecutive pixels in the iteration direction
-	int pixelStride() const
-	{
-		return vertical ? imageRowBytes : imagePixelBytes;
-	}
 
 	BYTE* pixelAt(int i) const
 	{
-		return imageBase + i * pixelStride();
+		return imageBase + i * imagePixelBytes;
 	}
 
 	void getRGB(int i, BYTE& r, BYTE& g, BYTE& b) const
@@ -61,44 +91,103 @@ struct RowAccessor
 };
 
 // ---------------------------------------------------------------------------
-// Threshold spans
+// Packed row accessor - one row of packed RGB (full-image rows, column
+// strips and staged rows)
 // ---------------------------------------------------------------------------
 
-inline void DetectSpansThreshold(
-	const RowAccessor& row,
-	float lowerNorm,
-	float upperNorm,
-	SortKey sortKey,
-	std::vector<Span>& outSpans)
+// RowAccessor with the layout fixed at 3 bytes per pixel in R, G, B order
+struct PackedRowAccessor
 {
-	outSpans.clear();
-	int n = row.length;
-	if (n <= 0) return;
+	BYTE*         imageBase;
+	int           length;
 
-	int spanStart = -1;
-	for (int i = 0; i <= n; ++i)
+	BYTE* pixelAt(int i) const
 	{
-		bool inRange = false;
-		if (i < n)
-		{
-			BYTE r, g, b;
-			row.getRGB(i, r, g, b);
-			float val = GetSortValueNorm(r, g, b, sortKey);
-			inRange = (val >= lowerNorm && val <= upperNorm);
-		}
+		return imageBase + static_cast<size_t>(i) * 3;
+	}
+
+	void getRGB(int i, BYTE& r, BYTE& g, BYTE& b) const
+	{
+		const BYTE* p = pixelAt(i);
+		r = p[0];
+		g = p[1];
+		b = p[2];
+	}
+
+	void setRGB(int i, BYTE r, BYTE g, BYTE b) const
+	{
+		BYTE* p = pixelAt(i);
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+	}
+};
 
-		if (inRange && spanStart < 0)
+// ---------------------------------------------------------------------------
+// Indexed row accessor - a traced line gathered through pixel indices
+// ---------------------------------------------------------------------------
+
+// Same interface as RowAccessor for a line whose pixels are scattered over a
+// packed RGB image (see LineLayout); position i is pixel indices[i].
+struct IndexedRowAccessor
+{
+	BYTE*         imageBase; // packed RGB, 3 bytes per pixel
+	const int*    indices;
+	int           length;
+
+	BYTE* pixelAt(int i) const
+	{
+		return imageBase + static_cast<size_t>(indices[i]) * 3;
+	}
+
+	void getRGB(int i, BYTE& r, BYTE& g, BYTE& b) const
+	{
+		const BYTE* p = pixelAt(i);
+		r = p[0];
+		g = p[1];
+		b = p[2];
+	}
+
+	void setRGB(int i, BYTE r, BYTE g, BYTE b) const
+	{
+		BYTE* p = pixelAt(i);
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Threshold spans
+// ---------------------------------------------------------------------------
+
+// lowerCode / upperCode come from SortKeyThresholdCode for the line's key
+inline void DetectSpansThreshold(
+	const KeyLine& keys,
+	int lowerCode,
+	int upperCode,
+	const SpanEmitter& emit)
+{
+	int n = keys.length;
+	int i = 0;
+	while (i < n)
+	{
+		// Skip the run outside the range, then take the run inside it
+		while (i < n)
 		{
-			spanStart = i;
+			int code = keys.at(i);
+			if (code >= lowerCode && code <= upperCode) break;
+			++i;
 		}
-		else if (!inRange && spanStart >= 0)
+		if (i == n) break;
+		int spanStart = i;
+		while (i < n)
 		{
-			Span s;
-			s.start = spanStart;
-			s.end = i;
-			outSpans.push_back(s);
-			spanStart = -1;
+			int code = keys.at(i);
+			if (code < lowerCode || code > upperCode) break;
+			++i;
 		}
+		emit.Emit(spanStart, i);
 	}
 }
 
@@ -106,28 +195,23 @@ inline void DetectSpansThreshold(
 // Random spans
 // ---------------------------------------------------------------------------
 
+// Span k of the line takes draws 2k (length) and 2k+1 (gap) under `lineKey`
 inline void DetectSpansRandom(
 	int n,
-	std::mt19937& rng,
-	std::vector<Span>& outSpans)
+	unsigned int lineKey,
+	const SpanEmitter& emit)
 {
-	outSpans.clear();
 	if (n <= 0) return;
 
 	int maxLen = (std::max)(11, n / 4);
 	int i = 0;
-	while (i < n)
+	for (unsigned int k = 0; i < n; ++k)
 	{
-		std::uniform_int_distribution<int> lenDist(10, maxLen);
-		int length = lenDist(rng);
+		int length = 10 + RandomBelow(RandomBits(lineKey, 2 * k), maxLen - 9);
 		int end = (std::min)(i + length, n);
-		Span s;
-		s.start = i;
-		s.end = end;
-		outSpans.push_back(s);
+		emit.Emit(i, end);
 
-		std::uniform_int_distribution<int> gapDist(1, 20);
-		int gap = gapDist(rng);
+		int gap = 1 + RandomBelow(RandomBits(lineKey, 2 * k + 1), 20);
 		i = end + gap;
 	}
 }
@@ -136,76 +220,41 @@ inline void DetectSpansRandom(
 // Edge spans
 // ---------------------------------------------------------------------------
 
+// `brightness` holds brightness key codes (GetSortKeyCode with
+// kSortKeyBrightness) for the line. The line is split after every gradient
+// above `limit` (see EdgeSplitLimit); kEdgeLimitPerLine takes the limit
+// from the line's own gradient statistics.
+static const int kEdgeLimitPerLine = -1;
+
 inline void DetectSpansEdges(
-	const RowAccessor& row,
-	std::vector<Span>& outSpans,
-	std::vector<float>& brightnessWork)
+	const KeyLine& brightness,
+	int limit,
+	const SpanEmitter& emit)
 {
-	outSpans.clear();
-	int n = row.length;
+	int n = brightness.length;
 	if (n <= 0) return;
-	if (n == 1)
-	{
-		Span s; s.start = 0; s.end = 1;
-		outSpans.push_back(s);
-		return;
-	}
 
-	// Compute brightness for each pixel
-	brightnessWork.resize(n);
-	for (int i = 0; i < n; ++i)
+	// Codes are contiguous (KeyPlane rows and traced lines)
+	const EdgeKernel& kernel = GetEdgeKernel();
+	const unsigned short* codes = brightness.base;
+	if (limit == kEdgeLimitPerLine)
 	{
-		BYTE r, g, b;
-		row.getRGB(i, r, g, b);
-		brightnessWork[i] = GetBrightnessNorm(r, g, b);
+		EdgeStats stats = MakeEdgeStats();
+		kernel.accumulate(codes, n, stats);
+		limit = EdgeSplitLimit(stats);
 	}
 
-	// Compute edge differences and statistics
+	// Split after every gradient above the limit
 	int nEdges = n - 1;
-	double edgeSum = 0.0;
-	double edgeSumSq = 0.0;
-
-	// Reuse brightnessWork tail for edge values (nEdges < n)
-	// We store edge values in a temporary section
-	std::vector<float> edges(nEdges);
-	for (int i = 0; i < nEdges; ++i)
-	{
-		edges[i] = fabsf(brightnessWork[i + 1] - brightnessWork[i]);
-		edgeSum += edges[i];
-		edgeSumSq += edges[i] * edges[i];
-	}
-
-	double mean = edgeSum / nEdges;
-	double variance = (edgeSumSq / nEdges) - (mean * mean);
-	if (variance < 0.0) variance = 0.0;
-	double stddev = sqrt(variance);
-	float threshold = static_cast<float>(mean + stddev);
-
-	// Find edge positions (split points)
 	int prevPos = 0;
-	for (int i = 0; i < nEdges; ++i)
+	for (int i = kernel.findSplit(codes, 0, n, limit); i < nEdges; i = kernel.findSplit(codes, i + 1, n, limit))
 	{
-		if (edges[i] > threshold)
-		{
-			int splitPos = i + 1;
-			if (splitPos > prevPos)
-			{
-				Span s;
-				s.start = prevPos;
-				s.end = splitPos;
-				outSpans.push_back(s);
-			}
-			prevPos = splitPos;
-		}
+		int splitPos = i + 1;
+		emit.Emit(prevPos, splitPos);
+		prevPos = splitPos;
 	}
 	// Last span
-	if (n > prevPos)
-	{
-		Span s;
-		s.start = prevPos;
-		s.end = n;
-		outSpans.push_back(s);
-	}
+	emit.Emit(prevPos, n);
 }
 
 // ---------------------------------------------------------------------------
@@ -215,9 +264,8 @@ inline void DetectSpansEdges(
 inline void DetectSpansWaves(
 	int n,
 	int rowIndex,
-	std::vector<Span>& outSpans)
+	const SpanEmitter& emit)
 {
-	outSpans.clear();
 	if (n <= 0) return;
 
 	int waveLen = (std::max)(10, n / 8);
@@ -228,10 +276,7 @@ inline void DetectSpansWaves(
 		int length = static_cast<int>(waveLen * (0.5 + 0.5 * sin(phase)));
 		length = (std::max)(2, length);
 		int end = (std::min)(i + length, n);
-		Span s;
-		s.start = i;
-		s.end = end;
-		outSpans.push_back(s);
+		emit.Emit(i, end);
 		i = end;
 		phase += 0.5;
 	}
@@ -241,82 +286,53 @@ inline void DetectSpansWaves(
 // None - single span covering full row
 // ---------------------------------------------------------------------------
 
-inline void DetectSpansNone(int n, std::vector<Span>& outSpans)
+inline void DetectSpansNone(int n, const SpanEmitter& emit)
 {
-	outSpans.clear();
-	if (n <= 0) return;
-	Span s;
-	s.start = 0;
-	s.end = n;
-	outSpans.push_back(s);
+	if (n > 0)
+		emit.Emit(0, n);
 }
 
 // ---------------------------------------------------------------------------
 // Dispatch + filter
 // ---------------------------------------------------------------------------
 
+// `keys` is the line's sort key codes, `brightness` its brightness codes
+// (only read in Edges mode; see KeyPlane). `edgeLimit` is the image-wide
+// Edges split limit, or kEdgeLimitPerLine. `rowIndex` keys Random mode's
+// draws (with params.seed) and Waves mode's phase. span_min and span_max are
+// applied while the spans are detected.
 inline void DetectSpans(
-	const RowAccessor& row,
+	const KeyLine& keys,
+	const KeyLine& brightness,
 	const PixelSortParams& params,
+	int edgeLimit,
 	int rowIndex,
-	std::mt19937& rng,
-	std::vector<Span>& outSpans,
-	std::vector<float>& brightnessWork)
+	std::vector<Span>& outSpans)
 {
-	float lowerNorm = params.lowerThreshold / 255.0f;
-	float upperNorm = params.upperThreshold / 255.0f;
+	int n = keys.length;
+	outSpans.clear();
+	SpanEmitter emit = { &outSpans, params.spanMin, params.spanMax };
 
 	switch (params.intervalMode)
 	{
 	case kIntervalModeThreshold:
-		DetectSpansThreshold(row, lowerNorm, upperNorm, params.sortKey, outSpans);
+		DetectSpansThreshold(keys,
+			SortKeyThresholdCode(params.sortKey, params.lowerThreshold),
+			SortKeyThresholdCode(params.sortKey, params.upperThreshold),
+			emit);
 		break;
 	case kIntervalModeRandom:
-		DetectSpansRandom(row.length, rng, outSpans);
+		DetectSpansRandom(n, MakeRandomLineKey(params.seed, kRandomStreamSpans, rowIndex), emit);
 		break;
 	case kIntervalModeEdges:
-		DetectSpansEdges(row, outSpans, brightnessWork);
+		DetectSpansEdges(brightness, edgeLimit, emit);
 		break;
 	case kIntervalModeWaves:
-		DetectSpansWaves(row.length, rowIndex, outSpans);
+		DetectSpansWaves(n, rowIndex, emit);
 		break;
 	case kIntervalModeNone:
 	default:
-		DetectSpansNone(row.length, outSpans);
+		DetectSpansNone(n, emit);
 		break;
 	}
-
-	// Filter by span_min
-	if (params.spanMin > 1)
-	{
-		int writeIdx = 0;
-		for (int i = 0; i < static_cast<int>(outSpans.size()); ++i)
-		{
-			if (outSpans[i].end - outSpans[i].start >= params.spanMin)
-				outSpans[writeIdx++] = outSpans[i];
-		}
-		outSpans.resize(writeIdx);
-	}
-
-	// Cap by span_max (split long spans)
-	if (params.spanMax > 0)
-	{
-		std::vector<Span> capped;
-		capped.reserve(outSpans.size());
-		for (int i = 0; i < static_cast<int>(outSpans.size()); ++i)
-		{
-			int s = outSpans[i].start;
-			int e = outSpans[i].end;
-			while (s < e)
-			{
-				int end = (std::min)(s + params.spanMax, e);
-				Span sp;
-				sp.start = s;
-				sp.end = end;
-				capped.push_back(sp);
-				s = end;
-			}
-		}
-		outSpans.swap(capped);
-	}
 }
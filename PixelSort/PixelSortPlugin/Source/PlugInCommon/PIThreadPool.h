@@ -0,0 +1,183 @@
+//! @file   PIThreadPool.h
+//! @brief  Persistent worker pool for splitting line work across cores
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <vector>
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+// Thread pool
+// ---------------------------------------------------------------------------
+
+// Workers are started once and parked on a condition variable between jobs,
+// so a preview restart does not pay thread creation cost. The calling thread
+// takes part in every job as worker 0.
+class PixelSortThreadPool
+{
+public:
+	// Range callback: worker index in [0, GetThreadCount()), items [begin, end)
+	typedef std::function<void(int worker, int begin, int end)> RangeFunc;
+
+	explicit PixelSortThreadPool(int threadCount = 0)
+		: m_job(NULL)
+		, m_itemCount(0)
+		, m_grain(1)
+		, m_generation(0)
+		, m_activeWorkers(0)
+		, m_shutdown(false)
+	{
+		if (threadCount <= 0)
+			threadCount = static_cast<int>(std::thread::hardware_concurrency());
+		threadCount = (std::max)(1, (std::min)(64, threadCount));
+
+		m_nextItem.store(0);
+		for (int i = 1; i < threadCount; ++i)
+			m_threads.push_back(std::thread(&PixelSortThreadPool::WorkerMain, this, i));
+	}
+
+	~PixelSortThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_shutdown = true;
+		}
+		m_wake.notify_all();
+		for (size_t i = 0; i < m_threads.size(); ++i)
+			m_threads[i].join();
+	}
+
+	int GetThreadCount() const
+	{
+		return static_cast<int>(m_threads.size()) + 1;
+	}
+
+	// Run fn over [0, itemCount) in chunks of `grain` items and block until
+	// every chunk is done. The first exception thrown by any worker is
+	// rethrown here after all workers have stopped.
+	void ParallelFor(int itemCount, int grain, const RangeFunc& fn)
+	{
+		if (itemCount <= 0) return;
+		grain = (std::max)(1, grain);
+
+		if (m_threads.empty() || itemCount <= grain)
+		{
+			fn(0, 0, itemCount);
+			return;
+		}
+
+		StartJob(itemCount, grain, fn);
+
+		RunChunks(0);
+		Wait();
+	}
+
+	// Starts fn over [0, itemCount) on the workers alone and returns at
+	// once, so the calling thread is free for other work (host I/O) until
+	// Wait. Worker 0 is never used, so its scratch stays with the caller.
+	// `fn` must outlive the job. With no workers the job runs here before
+	// returning.
+	void BeginParallelFor(int itemCount, int grain, const RangeFunc& fn)
+	{
+		if (itemCount <= 0) return;
+		grain = (std::max)(1, grain);
+
+		if (m_threads.empty())
+		{
+			fn(0, 0, itemCount);
+			return;
+		}
+
+		StartJob(itemCount, grain, fn);
+	}
+
+	// Blocks until the job of BeginParallelFor is done (at once if there is
+	// none) and rethrows its first exception
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_job == NULL) return;
+		m_done.wait(lock, [this] { return m_activeWorkers == 0; });
+		m_job = NULL;
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+
+private:
+	PixelSortThreadPool(const PixelSortThreadPool&);
+	PixelSortThreadPool& operator=(const PixelSortThreadPool&);
+
+	// Hands fn to every worker
+	void StartJob(int itemCount, int grain, const RangeFunc& fn)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &fn;
+			m_itemCount = itemCount;
+			m_grain = grain;
+			m_nextItem.store(0);
+			m_error = std::exception_ptr();
+			m_activeWorkers = static_cast<int>(m_threads.size());
+			++m_generation;
+		}
+		m_wake.notify_all();
+	}
+
+	void RunChunks(int worker)
+	{
+		for (;;)
+		{
+			int begin = m_nextItem.fetch_add(m_grain);
+			if (begin >= m_itemCount) break;
+			int end = (std::min)(begin + m_grain, m_itemCount);
+			try
+			{
+				(*m_job)(worker, begin, end);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_error) m_error = std::current_exception();
+				m_nextItem.store(m_itemCount); // stop handing out work
+			}
+		}
+	}
+
+	void WorkerMain(int worker)
+	{
+		unsigned int seenGeneration = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_shutdown || m_generation != seenGeneration; });
+				if (m_shutdown) return;
+				seenGeneration = m_generation;
+			}
+
+			RunChunks(worker);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_activeWorkers == 0)
+				m_done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::mutex               m_mutex;
+	std::condition_variable  m_wake;
+	std::condition_variable  m_done;
+	const RangeFunc*         m_job;
+	int                      m_itemCount;
+	int                      m_grain;
+	std::atomic<int>         m_nextItem;
+	unsigned int             m_generation;
+	int                      m_activeWorkers;
+	bool                     m_shutdown;
+	std::exception_ptr       m_error;
+};